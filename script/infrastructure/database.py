@@ -7,10 +7,11 @@ import sys
 CREATE_DB_PATH = "../build/db_builder"
 EXECUTE_DB_PATH = "../build/db_runner"
 THREADS = 4
+TEMPLATE_STORE = None  # directory db_builder keeps built trees in, None bulk loads the tree for every wrapper
 
 class RocksDBWrapper(object):
 
-    def __init__(self, db_path, T, K, Z, B, E, bpe, L, destroy=True):
+    def __init__(self, db_path, T, K, Z, B, E, bpe, L, destroy=True, template_store=TEMPLATE_STORE):
         self.db_path = db_path
         self.T = T  # Size ratio
         self.K = K  # Lower level size ratio
@@ -20,9 +21,12 @@ class RocksDBWrapper(object):
         self.bpe = bpe  # Bits per entry for bloom filter
         self.L = L  # Number of levels
         self.destroy = destroy  # destroy DB is exist in path
+        self.template_store = template_store  # reuse trees built with the same options
+        self.template_path = None  # template the DB was cloned from, every workload starts over from it
         self.log = logging.getLogger('exp_logger')
 
         self.time_prog = re.compile(r'\[[0-9:.]+\]\[info\] \(w, z1, z0\) : \((-?\d+), (-?\d+), (-?\d+)\)')
+        self.template_prog = re.compile(r'\[[0-9:.]+\]\[info\] Template : (\S+)')
         self._create_db()
 
     def _create_db(self):
@@ -39,6 +43,8 @@ class RocksDBWrapper(object):
             '-L {}'.format(self.L),
             '--parallelism {}'.format(THREADS),
         ]
+        if self.template_store is not None:
+            cmd.append(f'--template_store {self.template_store}')
         cmd = ' '.join(cmd)
         self.log.debug(f'Creating DB command : {cmd}')
 
@@ -50,6 +56,10 @@ class RocksDBWrapper(object):
             shell=True,
         ).communicate()[0]
 
+        template_result = self.template_prog.search(completed_process)
+        if template_result is not None:
+            self.template_path = template_result.group(1)
+
         return completed_process
 
     def run_workload(self, reads, empty_reads, writes, prime=1000000):
@@ -62,6 +72,8 @@ class RocksDBWrapper(object):
             f'-p {prime}',
             '--parallelism {}'.format(THREADS),
         ]
+        if self.template_path is not None:
+            cmd.append(f'--template {self.template_path}')
         cmd = ' '.join(cmd)
         self.log.debug(f'Running workload command : {cmd}')
 
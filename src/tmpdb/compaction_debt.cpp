@@ -0,0 +1,117 @@
+#include <algorithm>
+
+#include "tmpdb/compaction_debt.hpp"
+
+using namespace tmpdb;
+
+#define MIN_SLEEP_NANOS 1000000 //> 1 ms
+
+
+CompactionDebt::CompactionDebt(double smoothing)
+    : smoothing(smoothing),
+    ingest_bytes_per_sec(0),
+    compaction_bytes_per_sec(0),
+    last_flush_micros(0),
+    write_pressure(0),
+    pending_delay_nanos(0) {}
+
+
+void CompactionDebt::record_flush(uint64_t bytes, uint64_t now_micros)
+{
+    std::lock_guard<std::mutex> lock(this->rate_mutex);
+    if ((this->last_flush_micros > 0) && (now_micros > this->last_flush_micros))
+    {
+        double sample = bytes * 1e6 / (now_micros - this->last_flush_micros);
+        this->ingest_bytes_per_sec = (this->ingest_bytes_per_sec == 0)
+            ? sample
+            : (this->smoothing * sample) + ((1 - this->smoothing) * this->ingest_bytes_per_sec);
+    }
+    this->last_flush_micros = now_micros;
+}
+
+
+void CompactionDebt::record_compaction(uint64_t bytes_read, uint64_t elapsed_micros)
+{
+    if (elapsed_micros == 0) {return;}
+
+    std::lock_guard<std::mutex> lock(this->rate_mutex);
+    double sample = bytes_read * 1e6 / elapsed_micros;
+    this->compaction_bytes_per_sec = (this->compaction_bytes_per_sec == 0)
+        ? sample
+        : (this->smoothing * sample) + ((1 - this->smoothing) * this->compaction_bytes_per_sec);
+}
+
+
+double CompactionDebt::ingest_rate()
+{
+    std::lock_guard<std::mutex> lock(this->rate_mutex);
+    return this->ingest_bytes_per_sec;
+}
+
+
+double CompactionDebt::compaction_rate()
+{
+    std::lock_guard<std::mutex> lock(this->rate_mutex);
+    return this->compaction_bytes_per_sec;
+}
+
+
+uint64_t CompactionDebt::projected_inflow(uint64_t level_bytes)
+{
+    std::lock_guard<std::mutex> lock(this->rate_mutex);
+    if ((this->ingest_bytes_per_sec == 0) || (this->compaction_bytes_per_sec == 0))
+    {
+        return 0;
+    }
+
+    // Every level eventually receives the whole ingest stream, during a compaction it keeps arriving
+    double seconds_to_compact = level_bytes / this->compaction_bytes_per_sec;
+
+    return static_cast<uint64_t>(seconds_to_compact * this->ingest_bytes_per_sec);
+}
+
+
+bool CompactionDebt::overflow_imminent(uint64_t level_bytes, uint64_t level_capacity)
+{
+    if (level_bytes > level_capacity) {return true;}
+
+    return (level_bytes + this->projected_inflow(level_bytes)) > level_capacity;
+}
+
+
+void CompactionDebt::set_write_pressure(double pressure)
+{
+    this->write_pressure.store(std::max(0.0, std::min(pressure, 1.0)));
+}
+
+
+double CompactionDebt::get_write_pressure()
+{
+    return this->write_pressure.load();
+}
+
+
+uint64_t CompactionDebt::write_delay(size_t bytes)
+{
+    double pressure = this->write_pressure.load();
+    if (pressure <= 0) {return 0;}
+
+    double drain_rate = this->compaction_rate();
+    if (drain_rate <= 0) {return 0;}
+
+    // At full pressure writers are paced to what compactions drain, below that proportionally faster
+    uint64_t delay_nanos = static_cast<uint64_t>(bytes * pressure * 1e9 / drain_rate);
+    // Debt is claimed as a whole and only once it is worth a sleep, so concurrent writers never take the same debt
+    uint64_t pending = this->pending_delay_nanos.load();
+    while (true)
+    {
+        if (pending + delay_nanos < MIN_SLEEP_NANOS)
+        {
+            if (this->pending_delay_nanos.compare_exchange_weak(pending, pending + delay_nanos)) {return 0;}
+        }
+        else if (this->pending_delay_nanos.compare_exchange_weak(pending, 0))
+        {
+            return (pending + delay_nanos) / 1000;
+        }
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef COMPACTION_DEBT_H_
+#define COMPACTION_DEBT_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+namespace tmpdb
+{
+
+/**
+ * @brief Tracks how fast data enters the tree (flushes) and how fast compactions drain it, so the compactor can
+ * project when a level will overflow and pace writers before RocksDB's stall triggers kick in.
+ */
+class CompactionDebt
+{
+public:
+    /**
+     * @brief Construct a new Compaction Debt object
+     *
+     * @param smoothing Weight of the newest sample in the exponentially weighted rates
+     */
+    CompactionDebt(double smoothing = 0.2);
+
+    /**
+     * @brief Records a flush of bytes that completed at now_micros
+     */
+    void record_flush(uint64_t bytes, uint64_t now_micros);
+
+    /**
+     * @brief Records a compaction that read bytes_read in elapsed_micros
+     */
+    void record_compaction(uint64_t bytes_read, uint64_t elapsed_micros);
+
+    /**
+     * @brief Smoothed ingest rate (bytes / second), 0 until two flushes have been seen
+     */
+    double ingest_rate();
+
+    /**
+     * @brief Smoothed compaction throughput (bytes / second), 0 until a compaction has been seen
+     */
+    double compaction_rate();
+
+    /**
+     * @brief Projects whether a level will exceed its capacity before a compaction started now could drain it.
+     *
+     * @param level_bytes Bytes currently in the level
+     * @param level_capacity Capacity of the level in bytes
+     * @return true if the level should be compacted early
+     */
+    bool overflow_imminent(uint64_t level_bytes, uint64_t level_capacity);
+
+    /**
+     * @brief Bytes expected to land in a level while a compaction of level_bytes runs
+     */
+    uint64_t projected_inflow(uint64_t level_bytes);
+
+    /**
+     * @brief Sets how close writers are to stalling, from 0 (no backpressure) to 1 (paced to compaction throughput)
+     */
+    void set_write_pressure(double pressure);
+
+    double get_write_pressure();
+
+    /**
+     * @brief Microseconds a writer should wait after writing bytes, accumulated until worth sleeping for
+     *
+     * @param bytes Bytes just written
+     * @return uint64_t Time to sleep now, 0 if the accumulated delay is still below a millisecond
+     */
+    uint64_t write_delay(size_t bytes);
+
+private:
+    double smoothing;
+
+    std::mutex rate_mutex;
+    double ingest_bytes_per_sec;
+    double compaction_bytes_per_sec;
+    uint64_t last_flush_micros;
+
+    std::atomic<double> write_pressure;
+    std::atomic<uint64_t> pending_delay_nanos;
+};
+
+} /* namespace tmpdb */
+
+#endif /* COMPACTION_DEBT_H_ */
@@ -0,0 +1,178 @@
+#include "tmpdb/compaction_scheduler.hpp"
+#include "tmpdb/fluid_lsm_compactor.hpp"
+
+using namespace tmpdb;
+
+
+CompactionScheduler::CompactionScheduler(
+    CompactionFunction run_compaction,
+    size_t num_workers,
+    CompactionFunction drop_compaction)
+    : run_compaction(run_compaction),
+    drop_compaction(drop_compaction),
+    num_workers(std::max(num_workers, (size_t) 1)),
+    stopping(false) {}
+
+
+CompactionScheduler::~CompactionScheduler()
+{
+    this->shutdown();
+}
+
+
+bool CompactionScheduler::submit(CompactionTask *task)
+{
+    bool queued_new_entry = true;
+    {
+        std::unique_lock<std::mutex> lock(this->queue_mutex);
+        if (this->stopping)
+        {
+            // Compactions finishing during shutdown may still pick follow ups, none of them will ever run
+            lock.unlock();
+            this->drop(task);
+            return true;
+        }
+        if (this->workers.empty())
+        {
+            for (size_t worker_idx = 0; worker_idx < this->num_workers; worker_idx++)
+            {
+                this->workers.emplace_back(&CompactionScheduler::worker_loop, this);
+            }
+        }
+
+        for (auto &pending : this->pending_tasks)
+        {
+            // Output options depend on the output level, folding across outputs would compact into the wrong level
+            if ((pending->origin_level_id != task->origin_level_id) || (pending->output_level != task->output_level))
+            {
+                continue;
+            }
+
+            spdlog::trace("Folding CompactionTask L{} -> L{} into pending task",
+                task->origin_level_id + 1, task->output_level + 1);
+            for (auto &file_name : task->input_file_names)
+            {
+                auto &pending_files = pending->input_file_names;
+                if (std::find(pending_files.begin(), pending_files.end(), file_name) != pending_files.end()) {continue;}
+                pending_files.push_back(file_name);
+            }
+            pending->compact_options = task->compact_options;
+            pending->priority = std::max(pending->priority, task->priority);
+            pending->retry_on_fail = pending->retry_on_fail || task->retry_on_fail;
+            delete task;
+            queued_new_entry = false;
+            break;
+        }
+
+        if (queued_new_entry)
+        {
+            this->pending_tasks.push_back(task);
+        }
+    }
+    this->queue_cv.notify_one();
+
+    return queued_new_entry;
+}
+
+
+size_t CompactionScheduler::pending_count()
+{
+    std::lock_guard<std::mutex> lock(this->queue_mutex);
+    return this->pending_tasks.size();
+}
+
+
+void CompactionScheduler::shutdown()
+{
+    std::vector<CompactionTask *> dropped_tasks;
+    {
+        std::lock_guard<std::mutex> lock(this->queue_mutex);
+        this->stopping = true;
+        dropped_tasks.swap(this->pending_tasks);
+    }
+    this->queue_cv.notify_all();
+    for (auto &task : dropped_tasks)
+    {
+        this->drop(task);
+    }
+
+    for (auto &worker : this->workers)
+    {
+        if (worker.joinable()) {worker.join();}
+    }
+    this->workers.clear();
+}
+
+
+void CompactionScheduler::drop(CompactionTask *task)
+{
+    if (this->drop_compaction)
+    {
+        this->drop_compaction(task);
+    }
+    else
+    {
+        delete task;
+    }
+}
+
+
+CompactionTask *CompactionScheduler::pop_next_task()
+{
+    auto best = this->pending_tasks.end();
+    for (auto it = this->pending_tasks.begin(); it != this->pending_tasks.end(); it++)
+    {
+        if (this->running_levels.count((*it)->origin_level_id)) {continue;}
+        if ((best == this->pending_tasks.end()) || ((*it)->priority > (*best)->priority))
+        {
+            best = it;
+        }
+    }
+
+    if (best == this->pending_tasks.end())
+    {
+        return nullptr;
+    }
+
+    CompactionTask *task = *best;
+    this->pending_tasks.erase(best);
+
+    return task;
+}
+
+
+void CompactionScheduler::worker_loop()
+{
+    std::unique_lock<std::mutex> lock(this->queue_mutex);
+    while (true)
+    {
+        CompactionTask *task = nullptr;
+        this->queue_cv.wait(lock, [this, &task] {
+            if (this->stopping) {return true;}
+            task = this->pop_next_task();
+            return task != nullptr;
+        });
+        if (this->stopping)
+        {
+            if (task)
+            {
+                lock.unlock();
+                this->drop(task);
+            }
+            return;
+        }
+
+        size_t level_idx = task->origin_level_id;
+        spdlog::trace("Dispatching CompactionTask L{} -> L{} (priority {:.2f})",
+            level_idx + 1, task->output_level + 1, task->priority);
+        this->running_levels.insert(level_idx);
+        lock.unlock();
+
+        this->run_compaction(task);
+
+        lock.lock();
+        this->running_levels.erase(level_idx);
+        // A pending task blocked on this level may now be dispatched
+        this->queue_cv.notify_all();
+    }
+}
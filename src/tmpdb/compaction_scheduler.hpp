@@ -0,0 +1,87 @@
+#ifndef COMPACTION_SCHEDULER_H_
+#define COMPACTION_SCHEDULER_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+
+namespace tmpdb
+{
+
+struct CompactionTask;
+
+
+class CompactionScheduler
+{
+public:
+    typedef void (*CompactionFunction)(void *arg);
+
+    /**
+     * @brief Construct a new Compaction Scheduler object. Worker threads are only spawned once the first task is
+     * submitted, so an idle scheduler costs nothing.
+     *
+     * @param run_compaction Function executing (and taking ownership of) a single CompactionTask
+     * @param num_workers Number of threads running compactions concurrently
+     * @param drop_compaction Function taking ownership of a task that will never run, so its owner can release what
+     * the task holds. nullptr simply deletes dropped tasks.
+     */
+    CompactionScheduler(CompactionFunction run_compaction, size_t num_workers,
+        CompactionFunction drop_compaction = nullptr);
+
+    ~CompactionScheduler();
+
+    /**
+     * @brief Queues a task. Pending tasks are dispatched highest priority first, and at most one task per origin
+     * level runs at any time. If a task for the same origin and output level is already pending, the input files of
+     * the new task are folded into it and the new task is destroyed. Tasks of one origin level with different outputs
+     * (e.g. a cascading compaction) are queued separately and run one after another. Tasks submitted once shutting
+     * down are dropped.
+     *
+     * @param task
+     * @return true if the task was queued as a new entry, false if it was folded into a pending task of the same levels
+     */
+    bool submit(CompactionTask *task);
+
+    /**
+     * @brief Number of tasks queued but not yet dispatched
+     */
+    size_t pending_count();
+
+    /**
+     * @brief Drops all pending tasks through drop_compaction and joins the workers after their current task finishes.
+     */
+    void shutdown();
+
+private:
+    CompactionFunction run_compaction;
+    CompactionFunction drop_compaction;
+    size_t num_workers;
+    bool stopping;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::vector<CompactionTask *> pending_tasks;
+    std::set<size_t> running_levels;
+    std::vector<std::thread> workers;
+
+    void worker_loop();
+
+    void drop(CompactionTask *task);
+
+    /**
+     * @brief Removes and returns the highest priority pending task whose origin level is not currently being
+     * compacted. Must be called with queue_mutex held.
+     *
+     * @return CompactionTask* nullptr if no task can be dispatched right now
+     */
+    CompactionTask *pop_next_task();
+};
+
+} /* namespace tmpdb */
+
+#endif /* COMPACTION_SCHEDULER_H_ */
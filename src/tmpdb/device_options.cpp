@@ -0,0 +1,77 @@
+#include "tmpdb/device_options.hpp"
+
+using namespace tmpdb;
+using json = nlohmann::json;
+
+
+DeviceOptions::DeviceOptions(std::string config_path)
+{
+    this->read_config(config_path);
+}
+
+
+bool DeviceOptions::read_config(std::string config_path)
+{
+    json cfg;
+    std::ifstream read_cfg(config_path);
+    if (!read_cfg.is_open())
+    {
+        spdlog::warn("Unable to read file: {}", config_path);
+        spdlog::warn("Using default device options");
+        return false;
+    }
+    read_cfg >> cfg;
+
+    this->page_size = cfg["page_size"];
+    this->random_read_micros = cfg["random_read_micros"];
+    this->sequential_read_bytes_per_sec = cfg["sequential_read_bytes_per_sec"];
+    this->sequential_write_bytes_per_sec = cfg["sequential_write_bytes_per_sec"];
+
+    return true;
+}
+
+
+bool DeviceOptions::write_config(std::string config_path)
+{
+    json cfg;
+    cfg["page_size"] = this->page_size;
+    cfg["random_read_micros"] = this->random_read_micros;
+    cfg["sequential_read_bytes_per_sec"] = this->sequential_read_bytes_per_sec;
+    cfg["sequential_write_bytes_per_sec"] = this->sequential_write_bytes_per_sec;
+
+    std::ofstream out_cfg(config_path);
+    if (!out_cfg.is_open())
+    {
+        spdlog::error("Unable to create or open file: {}", config_path);
+        return false;
+    }
+    out_cfg << cfg.dump(4) << std::endl;
+    out_cfg.close();
+    spdlog::info("Writing device configuration file at {}", config_path);
+
+    return true;
+}
+
+
+DeviceCosts DeviceOptions::costs() const
+{
+    DeviceCosts device;
+    device.page_size = this->page_size;
+    if (this->random_read_micros <= 0)
+    {
+        return device;
+    }
+
+    if (this->sequential_read_bytes_per_sec > 0)
+    {
+        double page_micros = this->page_size * 1e6 / this->sequential_read_bytes_per_sec;
+        device.sequential_read_cost = page_micros / this->random_read_micros;
+    }
+    if (this->sequential_write_bytes_per_sec > 0)
+    {
+        double page_micros = this->page_size * 1e6 / this->sequential_write_bytes_per_sec;
+        device.write_cost = page_micros / this->random_read_micros;
+    }
+
+    return device;
+}
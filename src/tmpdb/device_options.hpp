@@ -0,0 +1,42 @@
+#ifndef DEVICE_OPTIONS_H_
+#define DEVICE_OPTIONS_H_
+
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include "spdlog/spdlog.h"
+#include "nlohmann/json.hpp"
+#include "tmpdb/lsm_cost_model.hpp"
+
+namespace tmpdb
+{
+
+/**
+ * @brief Measured performance of the device a DB lives on, stored as device_config.json beside fluid_config.json
+ */
+class DeviceOptions
+{
+public:
+    size_t page_size = 4096;                    //> bytes, unit of random reads
+    double random_read_micros = 0;              //> average latency of a random page read
+    double sequential_read_bytes_per_sec = 0;
+    double sequential_write_bytes_per_sec = 0;
+
+    DeviceOptions() {};
+
+    DeviceOptions(std::string config_path);
+
+    bool read_config(std::string config_path);
+
+    bool write_config(std::string config_path);
+
+    /**
+     * @brief Costs for the cost model in units of a random page read. Unmeasured values count as one I/O.
+     */
+    DeviceCosts costs() const;
+};
+
+} /* namespace tmpdb */
+
+#endif /* DEVICE_OPTIONS_H_ */
@@ -0,0 +1,155 @@
+#include "tmpdb/dynamic_monkey_filter_policy.hpp"
+
+using namespace tmpdb;
+
+#define MIN_OBSERVED_READS 1000
+#define MIN_ACCESS_WEIGHT 0.001 //> levels never reached still get a share, access patterns shift
+
+
+DynamicMonkeyFilterPolicy::DynamicMonkeyFilterPolicy(double bits_per_element, FluidLSMCompactor *compactor,
+    std::shared_ptr<rocksdb::Statistics> statistics)
+    : bits_per_element(bits_per_element),
+    compactor(compactor),
+    statistics(statistics),
+    default_policy(rocksdb::NewBloomFilterPolicy(bits_per_element)) {}
+
+
+const char *DynamicMonkeyFilterPolicy::Name() const
+{
+    // Same on-disk format as the builtin bloom filter
+    return this->default_policy->Name();
+}
+
+
+void DynamicMonkeyFilterPolicy::CreateFilter(const rocksdb::Slice *keys, int n, std::string *dst) const
+{
+    this->default_policy->CreateFilter(keys, n, dst);
+}
+
+
+bool DynamicMonkeyFilterPolicy::KeyMayMatch(const rocksdb::Slice &key, const rocksdb::Slice &filter) const
+{
+    return this->default_policy->KeyMayMatch(key, filter);
+}
+
+
+rocksdb::FilterBitsBuilder *DynamicMonkeyFilterPolicy::GetFilterBitsBuilder() const
+{
+    return this->default_policy->GetFilterBitsBuilder();
+}
+
+
+rocksdb::FilterBitsBuilder *DynamicMonkeyFilterPolicy::GetBuilderWithContext(
+    const rocksdb::FilterBuildingContext &context) const
+{
+    if (context.level_at_creation < 0)
+    {
+        // Level unknown (e.g. external SST files), fall back to the uniform allocation
+        return this->default_policy->GetBuilderWithContext(context);
+    }
+
+    size_t level_idx = context.level_at_creation;
+    double bits_per_key = this->bits_per_level(level_idx + 1)[level_idx];
+    spdlog::trace("Building filter for L{} with {:.1f} bits per key", level_idx + 1, bits_per_key);
+    if (bits_per_key <= 0)
+    {
+        // No builder, RocksDB writes no filter for the file
+        return nullptr;
+    }
+
+    return this->bloom_policy(bits_per_key)->GetBuilderWithContext(context);
+}
+
+
+rocksdb::FilterBitsReader *DynamicMonkeyFilterPolicy::GetFilterBitsReader(const rocksdb::Slice &contents) const
+{
+    // Probes and bits per key are encoded in every filter, any bloom policy reads all of them
+    return this->default_policy->GetFilterBitsReader(contents);
+}
+
+
+std::vector<double> DynamicMonkeyFilterPolicy::bits_per_level(size_t min_levels) const
+{
+    FluidOptions opt = this->compactor->current_options();
+    std::vector<uint64_t> level_bytes = this->compactor->level_bytes();
+
+    size_t levels = std::max(min_levels, opt.levels);
+    for (size_t level_idx = 0; level_idx < level_bytes.size(); level_idx++)
+    {
+        if (level_bytes[level_idx] > 0) {levels = std::max(levels, level_idx + 1);}
+    }
+
+    std::vector<double> entries_per_level(levels), runs_per_level(levels);
+    double num_entries = 0;
+    for (size_t level_idx = 0; level_idx < levels; level_idx++)
+    {
+        bool occupied = (level_idx < level_bytes.size()) && (level_bytes[level_idx] > 0);
+        uint64_t bytes = occupied ? level_bytes[level_idx] : opt.level_capacity(level_idx);
+        entries_per_level[level_idx] = static_cast<double>(bytes) / opt.entry_size;
+        runs_per_level[level_idx] = opt.level_run_max(level_idx, level_idx == levels - 1);
+        num_entries += entries_per_level[level_idx];
+    }
+
+    std::vector<double> fprs = LSMCostModel::monkey_false_positive_rates(
+        entries_per_level, runs_per_level, this->bits_per_element * num_entries,
+        this->access_weights(entries_per_level));
+    std::vector<double> bits(levels);
+    for (size_t level_idx = 0; level_idx < levels; level_idx++)
+    {
+        bits[level_idx] = LSMCostModel::bits_per_key(fprs[level_idx]);
+    }
+
+    return bits;
+}
+
+
+std::vector<double> DynamicMonkeyFilterPolicy::access_weights(const std::vector<double> &entries_per_level) const
+{
+    std::vector<double> weights;
+    if (!this->statistics) {return weights;}
+
+    double reads = this->statistics->getTickerCount(rocksdb::NUMBER_KEYS_READ);
+    if (reads < MIN_OBSERVED_READS) {return weights;}
+
+    double hits[] = {
+        static_cast<double>(this->statistics->getTickerCount(rocksdb::GET_HIT_L0)),
+        static_cast<double>(this->statistics->getTickerCount(rocksdb::GET_HIT_L1)),
+        static_cast<double>(this->statistics->getTickerCount(rocksdb::GET_HIT_L2_AND_UP))};
+
+    double deep_entries = 0;
+    for (size_t level_idx = 2; level_idx < entries_per_level.size(); level_idx++)
+    {
+        deep_entries += entries_per_level[level_idx];
+    }
+
+    double answered_above = 0;
+    for (size_t level_idx = 0; level_idx < entries_per_level.size(); level_idx++)
+    {
+        weights.push_back(std::max(1.0 - answered_above / reads, MIN_ACCESS_WEIGHT));
+        if (level_idx < 2)
+        {
+            answered_above += hits[level_idx];
+        }
+        else if (deep_entries > 0)
+        {
+            answered_above += hits[2] * entries_per_level[level_idx] / deep_entries;
+        }
+    }
+
+    return weights;
+}
+
+
+const rocksdb::FilterPolicy *DynamicMonkeyFilterPolicy::bloom_policy(double bits_per_key) const
+{
+    int tenths = static_cast<int>(std::round(bits_per_key * 10));
+
+    std::lock_guard<std::mutex> lock(this->policies_mutex);
+    auto &policy = this->policies[tenths];
+    if (!policy)
+    {
+        policy.reset(rocksdb::NewBloomFilterPolicy(tenths / 10.0));
+    }
+
+    return policy.get();
+}
@@ -0,0 +1,93 @@
+#ifndef DYNAMIC_MONKEY_FILTER_POLICY_H_
+#define DYNAMIC_MONKEY_FILTER_POLICY_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rocksdb/filter_policy.h"
+#include "rocksdb/slice.h"
+#include "rocksdb/statistics.h"
+#include "rocksdb/table.h"
+
+#include "spdlog/spdlog.h"
+#include "tmpdb/fluid_lsm_compactor.hpp"
+#include "tmpdb/lsm_cost_model.hpp"
+
+namespace tmpdb
+{
+
+/**
+ * @brief Bloom filter policy giving every newly written SST the Monkey-optimal bits per key for the level it is
+ * created at. Unlike a policy fixed at open time, the allocation is recomputed from the live level view, so it keeps
+ * up as the tree grows new levels. With statistics, the allocation also follows the measured hit rates: levels that
+ * lookups rarely reach (e.g. under skew, where most lookups are answered near the top) give up memory to those that
+ * are probed. A new allocation reaches a level as its files are rewritten by compactions. Filters are plain bloom
+ * filters, hence reading them is delegated to the builtin policy and trees built with either policy stay readable by
+ * the other.
+ */
+class DynamicMonkeyFilterPolicy : public rocksdb::FilterPolicy
+{
+public:
+    /**
+     * @brief Construct a new Dynamic Monkey Filter Policy object
+     *
+     * @param bits_per_element Average bits per entry over the whole tree (h)
+     * @param compactor Compactor whose level view and shape drive the allocation
+     * @param statistics When set, levels are additionally weighted by how often lookups actually reach them
+     */
+    DynamicMonkeyFilterPolicy(double bits_per_element, FluidLSMCompactor *compactor,
+        std::shared_ptr<rocksdb::Statistics> statistics = nullptr);
+
+    const char *Name() const override;
+
+    void CreateFilter(const rocksdb::Slice *keys, int n, std::string *dst) const override;
+
+    bool KeyMayMatch(const rocksdb::Slice &key, const rocksdb::Slice &filter) const override;
+
+    rocksdb::FilterBitsBuilder *GetFilterBitsBuilder() const override;
+
+    /**
+     * @brief Builder for a file created at context.level_at_creation, nullptr when the level is allocated no bits,
+     * in which case the file is written without a filter
+     */
+    rocksdb::FilterBitsBuilder *GetBuilderWithContext(const rocksdb::FilterBuildingContext &context) const override;
+
+    rocksdb::FilterBitsReader *GetFilterBitsReader(const rocksdb::Slice &contents) const override;
+
+    /**
+     * @brief Current allocation of bits per key for every level. Occupied levels are weighted by the entries they
+     * hold, empty levels up to min_levels by their capacity as they are about to receive data.
+     *
+     * @param min_levels Number of levels to allocate at least
+     * @return std::vector<double> Bits per key of each level, 0 means no filter
+     */
+    std::vector<double> bits_per_level(size_t min_levels) const;
+
+    /**
+     * @brief Fraction of lookups reaching each level, derived from the per level hit tickers. A lookup reaches a
+     * level unless it was answered above it. RocksDB only counts hits up to its second level separately, hits
+     * further down are spread over the deeper levels by the entries they hold.
+     *
+     * @param entries_per_level Entries at each level
+     * @return std::vector<double> Weight of each level, empty without statistics or enough lookups to go by
+     */
+    std::vector<double> access_weights(const std::vector<double> &entries_per_level) const;
+
+private:
+    double bits_per_element;
+    FluidLSMCompactor *compactor;
+    std::shared_ptr<rocksdb::Statistics> statistics;
+    std::unique_ptr<const rocksdb::FilterPolicy> default_policy;
+
+    mutable std::mutex policies_mutex;
+    mutable std::map<int, std::unique_ptr<const rocksdb::FilterPolicy>> policies; //> keyed by tenths of a bit per key
+
+    const rocksdb::FilterPolicy *bloom_policy(double bits_per_key) const;
+};
+
+} /* namespace tmpdb */
+
+#endif /* DYNAMIC_MONKEY_FILTER_POLICY_H_ */
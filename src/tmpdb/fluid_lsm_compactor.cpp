@@ -11,22 +11,30 @@ FluidCompactor::FluidCompactor(const FluidOptions fluid_opt, const rocksdb::Opti
 }
 
 
-int FluidLSMCompactor::largest_occupied_level(rocksdb::DB *db) const
+int FluidLSMCompactor::largest_occupied_level(rocksdb::DB *db)
+{
+    this->init_level_view(db);
+
+    return this->largest_occupied_level_idx();
+}
+
+
+int FluidLSMCompactor::largest_occupied_level_idx()
 {
-    rocksdb::ColumnFamilyMetaData cf_meta;
-    db->GetColumnFamilyMetaData(&cf_meta);
     int largest_level_idx = 0;
 
-    for (size_t level_idx = cf_meta.levels.size() - 1; level_idx > 0; level_idx--)
+    for (size_t level_idx = this->level_view.size() - 1; level_idx > 0; level_idx--)
     {
-        if (cf_meta.levels[level_idx].files.empty()) {continue;}
+        std::lock_guard<std::mutex> level_lock(this->level_view[level_idx].mutex);
+        if (this->level_view[level_idx].files.empty()) {continue;}
         largest_level_idx = level_idx;
         break;
     }
     
     if (largest_level_idx == 0)
     {
-        if (cf_meta.levels[0].files.empty())
+        std::lock_guard<std::mutex> level_lock(this->level_view[0].mutex);
+        if (this->level_view[0].files.empty())
         {
             spdlog::error("Database is empty, exiting");
             exit(EXIT_FAILURE);
@@ -37,85 +45,524 @@ int FluidLSMCompactor::largest_occupied_level(rocksdb::DB *db) const
 }
 
 
-CompactionTask *FluidLSMCompactor::PickCompaction(rocksdb::DB *db, const std::string &cf_name, const size_t level_idx)
+void FluidLSMCompactor::refresh_level_view(rocksdb::DB *db)
 {
-    this->meta_data_mutex.lock();
-    int live_runs;
-    int T = this->fluid_opt.size_ratio;
-    int largest_level_idx = this->largest_occupied_level(db);
+    std::lock_guard<std::mutex> lock(this->meta_data_mutex);
+    this->load_level_view(db);
+}
+
+
+void FluidLSMCompactor::init_level_view(rocksdb::DB *db)
+{
+    if (this->level_view_initialized) {return;}
+
+    std::lock_guard<std::mutex> lock(this->meta_data_mutex);
+    if (this->level_view_initialized) {return;}
+    this->load_level_view(db);
+}
+
+
+void FluidLSMCompactor::load_level_view(rocksdb::DB *db)
+{
+    this->load_levels(db, 0, this->level_view.size());
+    this->level_view_initialized = true;
+}
 
+
+void FluidLSMCompactor::refresh_level_view(rocksdb::DB *db, size_t first_level_idx, size_t end_level_idx)
+{
+    std::lock_guard<std::mutex> lock(this->meta_data_mutex);
+    this->load_levels(db, first_level_idx, end_level_idx);
+}
+
+
+void FluidLSMCompactor::load_levels(rocksdb::DB *db, size_t first_level_idx, size_t end_level_idx)
+{
     rocksdb::ColumnFamilyMetaData cf_meta;
     db->GetColumnFamilyMetaData(&cf_meta);
+    end_level_idx = std::min(end_level_idx, std::min(cf_meta.levels.size(), this->level_view.size()));
 
-    std::vector<std::string> input_file_names;
+    // The levels are held together, lowest first as picks do, so a claimed file moved to another level of the range
+    // stays claimed
+    std::vector<std::unique_lock<std::mutex>> level_locks;
+    std::set<std::string> claimed_names;
+    for (size_t level_idx = first_level_idx; level_idx < end_level_idx; level_idx++)
+    {
+        LevelShape &level = this->level_view[level_idx];
+        level_locks.emplace_back(level.mutex);
+        for (auto &file : level.files)
+        {
+            if (file.being_compacted) {claimed_names.insert(file.name);}
+        }
+    }
 
-    size_t level_size = 0;
-    for (auto &file : cf_meta.levels[level_idx].files)
+    for (size_t level_idx = first_level_idx; level_idx < end_level_idx; level_idx++)
     {
-        if (file.being_compacted) {continue;}
-        input_file_names.push_back(file.name);
-        level_size += file.size;
+        LevelShape &level = this->level_view[level_idx];
+        std::vector<FileShape> files;
+        level.bytes = 0;
+        level.files_being_compacted = 0;
+        level.bytes_being_compacted = 0;
+        for (auto &file : cf_meta.levels[level_idx].files)
+        {
+            std::string name = FluidLSMCompactor::view_file_name(file.name);
+            bool claimed = claimed_names.count(name) > 0;
+            files.push_back({name, file.size, claimed});
+            level.bytes += file.size;
+            if (claimed)
+            {
+                level.files_being_compacted++;
+                level.bytes_being_compacted += file.size;
+            }
+        }
+        level.files.swap(files);
+    }
+}
+
+
+uint64_t FluidLSMCompactor::add_file_to_view(size_t level_idx, const std::string &file_path)
+{
+    uint64_t file_size = 0;
+    rocksdb::Status s = this->rocksdb_opt.env->GetFileSize(file_path, &file_size);
+    if (!s.ok())
+    {
+        spdlog::warn("Unable to size {} for the level view: {}", file_path, s.ToString());
+    }
+
+    if (level_idx >= this->level_view.size())
+    {
+        spdlog::warn("File {} is beyond the {} levels tracked by the compactor", file_path, this->level_view.size());
+        return file_size;
+    }
+
+    std::string name = FluidLSMCompactor::view_file_name(file_path);
+    LevelShape &level = this->level_view[level_idx];
+    std::lock_guard<std::mutex> level_lock(level.mutex);
+    for (auto &file : level.files)
+    {
+        if (file.name == name) {return file_size;}
+    }
+    level.files.push_back({name, file_size, false});
+    level.bytes += file_size;
+
+    return file_size;
+}
+
+
+void FluidLSMCompactor::update_write_pressure()
+{
+    // Ramp backpressure from twice the compaction trigger up to the point where RocksDB would start slowing writes
+    double soft_limit = 2 * std::max(this->rocksdb_opt.level0_file_num_compaction_trigger, 1);
+    double hard_limit = this->rocksdb_opt.level0_slowdown_writes_trigger;
+    if (hard_limit <= soft_limit)
+    {
+        this->debt.set_write_pressure(0);
+        return;
+    }
+
+    double level0_files;
+    {
+        std::lock_guard<std::mutex> level_lock(this->level_view[0].mutex);
+        level0_files = this->level_view[0].files.size();
+    }
+    this->debt.set_write_pressure((level0_files - soft_limit) / (hard_limit - soft_limit));
+}
+
+
+void FluidLSMCompactor::throttle_write(size_t bytes)
+{
+    uint64_t delay_micros = this->debt.write_delay(bytes);
+    if (delay_micros > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(delay_micros));
+    }
+}
+
+
+void FluidLSMCompactor::remove_file_from_view(const std::string &file_path)
+{
+    std::string name = FluidLSMCompactor::view_file_name(file_path);
+    for (auto &level : this->level_view)
+    {
+        std::lock_guard<std::mutex> level_lock(level.mutex);
+        for (auto file = level.files.begin(); file != level.files.end(); file++)
+        {
+            if (file->name != name) {continue;}
+            level.bytes -= file->size;
+            if (file->being_compacted)
+            {
+                level.files_being_compacted--;
+                level.bytes_being_compacted -= file->size;
+            }
+            level.files.erase(file);
+            return;
+        }
+    }
+}
+
+
+std::vector<uint64_t> FluidLSMCompactor::level_bytes()
+{
+    std::vector<uint64_t> bytes;
+    if (!this->level_view_initialized) {return bytes;}
+
+    bytes.reserve(this->level_view.size());
+    for (auto &level : this->level_view)
+    {
+        std::lock_guard<std::mutex> level_lock(level.mutex);
+        bytes.push_back(level.bytes);
+    }
+
+    return bytes;
+}
+
+
+FluidOptions FluidLSMCompactor::current_options()
+{
+    std::lock_guard<std::mutex> lock(this->fluid_opt_mutex);
+    return this->fluid_opt;
+}
+
+
+void FluidLSMCompactor::copy_shape(const FluidOptions &from, FluidOptions &to)
+{
+    to.size_ratio = from.size_ratio;
+    to.lower_level_run_max = from.lower_level_run_max;
+    to.largest_level_run_max = from.largest_level_run_max;
+    to.size_ratio_per_level = from.size_ratio_per_level;
+    to.run_max_per_level = from.run_max_per_level;
+    to.bits_per_element = from.bits_per_element;
+}
+
+
+void FluidLSMCompactor::update_options(const FluidOptions &new_opt)
+{
+    std::lock_guard<std::mutex> lock(this->fluid_opt_mutex);
+    FluidLSMCompactor::copy_shape(new_opt, this->fluid_opt);
+    this->level_migrating.clear();
+    spdlog::info("Tree shape updated to (T, K, Z) : ({}, {}, {})",
+        this->fluid_opt.size_ratio, this->fluid_opt.lower_level_run_max, this->fluid_opt.largest_level_run_max);
+}
+
+
+void FluidLSMCompactor::begin_migration(const FluidOptions &target)
+{
+    // Empty levels have nothing to migrate, data reaching them later already follows the new shape
+    std::vector<bool> occupied(this->level_view.size(), false);
+    for (size_t level_idx = 0; level_idx < this->level_view.size(); level_idx++)
+    {
+        std::lock_guard<std::mutex> level_lock(this->level_view[level_idx].mutex);
+        occupied[level_idx] = !this->level_view[level_idx].files.empty();
+    }
+
+    std::lock_guard<std::mutex> lock(this->fluid_opt_mutex);
+    // Levels still migrating from an earlier target are held to that target from now on
+    this->migration_source = this->fluid_opt;
+    FluidLSMCompactor::copy_shape(target, this->fluid_opt);
+    this->level_migrating = occupied;
+    if (std::find(occupied.begin(), occupied.end(), true) == occupied.end())
+    {
+        this->level_migrating.clear();
+    }
+    spdlog::info("Migrating tree shape from (T, K, Z) : ({}, {}, {}) to ({}, {}, {})",
+        this->migration_source.size_ratio,
+        this->migration_source.lower_level_run_max,
+        this->migration_source.largest_level_run_max,
+        this->fluid_opt.size_ratio,
+        this->fluid_opt.lower_level_run_max,
+        this->fluid_opt.largest_level_run_max);
+}
+
+
+bool FluidLSMCompactor::migration_in_progress()
+{
+    std::lock_guard<std::mutex> lock(this->fluid_opt_mutex);
+    return !this->level_migrating.empty();
+}
+
+
+void FluidLSMCompactor::finish_level_migration(size_t level_idx)
+{
+    std::lock_guard<std::mutex> lock(this->fluid_opt_mutex);
+    if (level_idx >= this->level_migrating.size()) {return;}
+
+    this->level_migrating[level_idx] = false;
+    if (std::find(this->level_migrating.begin(), this->level_migrating.end(), true) == this->level_migrating.end())
+    {
+        this->level_migrating.clear();
+        spdlog::info("Tree shape migration finished");
+    }
+}
+
+
+bool FluidLSMCompactor::over_limit(
+    const FluidOptions &opt, size_t level_idx, int largest_level_idx, int live_runs, uint64_t level_size)
+{
+    if (opt.file_size_policy_opt == INCREASING)
+    {
+        return live_runs > opt.level_run_max(level_idx, (int) level_idx == largest_level_idx);
+    }
+
+    return this->debt.overflow_imminent(level_size, opt.level_capacity(level_idx));
+}
+
+
+uint64_t FluidLSMCompactor::tree_bytes()
+{
+    uint64_t bytes = 0;
+    for (auto &level : this->level_view)
+    {
+        std::lock_guard<std::mutex> level_lock(level.mutex);
+        bytes += level.bytes;
+    }
+
+    return bytes;
+}
+
+
+void FluidLSMCompactor::release_files(const std::vector<std::string> &file_names)
+{
+    std::set<std::string> names;
+    for (auto &file_name : file_names)
+    {
+        names.insert(FluidLSMCompactor::view_file_name(file_name));
+    }
+
+    for (auto &level : this->level_view)
+    {
+        std::lock_guard<std::mutex> level_lock(level.mutex);
+        if (level.files_being_compacted == 0) {continue;}
+        for (auto &file : level.files)
+        {
+            if (!file.being_compacted || !names.count(file.name)) {continue;}
+            file.being_compacted = false;
+            level.files_being_compacted--;
+            level.bytes_being_compacted -= file.size;
+        }
+    }
+}
+
+
+uint64_t FluidLSMCompactor::file_number(const std::string &file_name)
+{
+    size_t sep = file_name.find_last_of('/');
+    size_t start = (sep == std::string::npos) ? 0 : sep + 1;
+
+    return std::strtoull(file_name.c_str() + start, nullptr, 10);
+}
+
+
+std::string FluidLSMCompactor::view_file_name(const std::string &file_path)
+{
+    size_t sep = file_path.find_last_of('/');
+    return "/" + ((sep == std::string::npos) ? file_path : file_path.substr(sep + 1));
+}
+
+
+CompactionTask *FluidLSMCompactor::PickCompaction(rocksdb::DB *db, const std::string &cf_name, const size_t level_idx)
+{
+    this->init_level_view(db);
+    if (level_idx >= this->level_view.size())
+    {
+        return nullptr;
+    }
+
+    int largest_level_idx = this->largest_occupied_level_idx();
+    FluidOptions opt, migration_source;
+    bool level_migrating;
+    {
+        std::lock_guard<std::mutex> lock(this->fluid_opt_mutex);
+        opt = this->fluid_opt;
+        level_migrating = (level_idx < this->level_migrating.size()) && this->level_migrating[level_idx];
+        if (level_migrating) {migration_source = this->migration_source;}
     }
-    live_runs = input_file_names.size();
 
-    if (fluid_opt.file_size_policy_opt == INCREASING)
+    // Only this level is locked, picks for other levels proceed in parallel
+    LevelShape &level = this->level_view[level_idx];
+    std::unique_lock<std::mutex> level_lock(level.mutex);
+    int live_runs = level.files.size() - level.files_being_compacted;
+    size_t level_size = level.bytes - level.bytes_being_compacted;
+
+    // A migrating level keeps the limits of its previous shape until it is compacted anyway. Compactions needed only
+    // by the new shape are forced one at a time while no other compaction is outstanding, so the migration never
+    // competes with regular compactions (nor writes) for bandwidth.
+    bool forced_migration = false;
+    if (level_migrating)
     {
-        bool lower_levels_need_compact = (((int) level_idx < largest_level_idx) && (live_runs > this->fluid_opt.lower_level_run_max));
-        bool last_levels_need_compact = (((int) level_idx == largest_level_idx) && (live_runs > this->fluid_opt.largest_level_run_max));
+        bool natural = this->over_limit(migration_source, level_idx, largest_level_idx, live_runs, level_size);
+        bool required = this->over_limit(opt, level_idx, largest_level_idx, live_runs, level_size);
+        if (!natural && required)
+        {
+            if ((this->compactions_left_count > 0) || (this->scheduler.pending_count() > 0))
+            {
+                return nullptr;
+            }
+            forced_migration = true;
+        }
+        this->finish_level_migration(level_idx);
+    }
+
+    // Level pressure ranks this task against others waiting in the scheduler
+    double level_pressure;
+    uint64_t bytes_to_pick = level_size;
+    if (opt.file_size_policy_opt == INCREASING)
+    {
+        bool lower_levels_need_compact = (((int) level_idx < largest_level_idx) && (live_runs > opt.level_run_max(level_idx, false)));
+        bool last_levels_need_compact = (((int) level_idx == largest_level_idx) && (live_runs > opt.level_run_max(level_idx, true)));
 
         if (!lower_levels_need_compact && !last_levels_need_compact)
         {
-            this->meta_data_mutex.unlock();
             return nullptr;
         }
+
+        int run_max = opt.level_run_max(level_idx, last_levels_need_compact);
+        level_pressure = static_cast<double>(live_runs) / run_max;
     }
     else
     {
-        uint64_t level_capacity = pow(T, level_idx) * (T - 1) * this->fluid_opt.buffer_size;
+        uint64_t level_capacity = opt.level_capacity(level_idx);
         spdlog::info("Level Capacity at level {} : {} MB", level_idx, level_capacity >> 20);
-        bool level_need_compaction = (level_size > (pow(T, level_idx) * (T - 1) * this->fluid_opt.buffer_size));
-        if (!level_need_compaction)
+        // Start early when the level is projected to overflow before a compaction could drain it
+        uint64_t projected_size = level_size + this->debt.projected_inflow(level_size);
+        if (projected_size <= level_capacity)
         {
-            this->meta_data_mutex.unlock();
             return nullptr;
         }
+
+        level_pressure = static_cast<double>(level_size) / level_capacity;
+        if (opt.partial_compaction)
+        {
+            // Only move out enough files to bring the level (and what arrives meanwhile) back under capacity
+            bytes_to_pick = std::min<uint64_t>(projected_size - level_capacity, level_size);
+        }
     }
 
-    if (fluid_opt.file_size_policy_opt == INCREASING)
+    // The first level additionally gets closer to stalling writers with every flush
+    if ((level_idx == 0) && (this->rocksdb_opt.level0_slowdown_writes_trigger > 0))
     {
+        level_pressure += static_cast<double>(level.files.size())
+            / this->rocksdb_opt.level0_slowdown_writes_trigger;
+    }
 
-        size_t level_capacity = (T - 1) * std::pow(T, level_idx + 1) * (this->fluid_opt.buffer_size);
-        if ((int) level_idx == this->largest_occupied_level(db)) //> Last level we restrict number of runs to Z
+    // Claim the picked files so concurrent picks and flushes do not hand them out twice. Files are taken oldest
+    // first, so partial compactions cycle through the whole level over time.
+    std::vector<FileShape *> candidates;
+    candidates.reserve(live_runs);
+    for (auto &file : level.files)
+    {
+        if (file.being_compacted) {continue;}
+        candidates.push_back(&file);
+    }
+    if (bytes_to_pick < level_size)
+    {
+        std::sort(candidates.begin(), candidates.end(), [](const FileShape *lhs, const FileShape *rhs) {
+            return FluidLSMCompactor::file_number(lhs->name) < FluidLSMCompactor::file_number(rhs->name);
+        });
+    }
+
+    std::vector<std::string> input_file_names;
+    input_file_names.reserve(live_runs);
+    uint64_t picked_bytes = 0;
+    for (auto file : candidates)
+    {
+        if (picked_bytes >= bytes_to_pick) {break;}
+        file->being_compacted = true;
+        input_file_names.push_back(file->name);
+        picked_bytes += file->size;
+        level.files_being_compacted++;
+        level.bytes_being_compacted += file->size;
+    }
+    if (input_file_names.empty())
+    {
+        // Every file is already claimed by another compaction
+        return nullptr;
+    }
+
+    // When receiving this level would make the next one overflow as well, merge both into the level after in one
+    // pass instead of rewriting the same data twice in quick succession
+    size_t output_level_idx = level_idx + 1;
+    if (opt.cascade_compaction && (picked_bytes >= level_size) && (level_idx + 2 < this->level_view.size()))
+    {
+        LevelShape &next_level = this->level_view[level_idx + 1];
+        std::lock_guard<std::mutex> next_level_lock(next_level.mutex);
+
+        bool next_level_overflows;
+        if (opt.file_size_policy_opt == INCREASING)
         {
-            this->rocksdb_compact_opt.output_file_size_limit = static_cast<uint64_t>(level_capacity) / this->fluid_opt.largest_level_run_max;
+            int next_run_max = opt.level_run_max(level_idx + 1, (int) level_idx + 1 == largest_level_idx);
+            next_level_overflows = (int) (next_level.files.size() + 1) > next_run_max;
         }
         else
         {
-            this->rocksdb_compact_opt.output_file_size_limit = static_cast<uint64_t>(level_capacity) / this->fluid_opt.lower_level_run_max;
+            uint64_t next_level_capacity = opt.level_capacity(level_idx + 1);
+            next_level_overflows = (next_level.bytes + picked_bytes) > next_level_capacity;
+        }
+
+        if (next_level_overflows && !next_level.files.empty() && (next_level.files_being_compacted == 0))
+        {
+            for (auto &file : next_level.files)
+            {
+                file.being_compacted = true;
+                input_file_names.push_back(file.name);
+            }
+            next_level.files_being_compacted = next_level.files.size();
+            next_level.bytes_being_compacted = next_level.bytes;
+            output_level_idx = level_idx + 2;
         }
+    }
+
+    level_lock.unlock();
+
+    rocksdb::CompactionOptions compact_opt = this->compaction_options(
+        output_level_idx - 1, (int) (output_level_idx - 1) == largest_level_idx);
+
+    spdlog::trace("Created CompactionTask L{} -> L{} (pressure {:.2f}{}{})",
+        level_idx + 1, output_level_idx + 1, level_pressure,
+        (output_level_idx > level_idx + 1) ? ", cascading" : "",
+        forced_migration ? ", migration" : "");
+    CompactionTask *task = new CompactionTask(
+        db, this, cf_name, input_file_names, output_level_idx, compact_opt, level_idx, false, false);
+    task->priority = forced_migration ? 0 : level_pressure;
+
+    return task;
+}
+
+
+rocksdb::CompactionOptions FluidLSMCompactor::compaction_options(size_t level_idx, bool last_level)
+{
+    // Every task carries its own options, concurrent picks never write to shared state
+    rocksdb::CompactionOptions compact_opt = this->rocksdb_compact_opt;
+    FluidOptions opt = this->current_options();
+    if (opt.file_size_policy_opt == INCREASING)
+    {
+        // Last level we restrict number of runs to Z, every other level to its K_i
+        uint64_t level_capacity = opt.level_capacity(level_idx + 1);
+        compact_opt.output_file_size_limit = level_capacity / opt.level_run_max(level_idx + 1, last_level);
 
         // We give an extra 5% memory per file in order to accomodate meta data
-        this->rocksdb_compact_opt.output_file_size_limit *= 1.05;
+        compact_opt.output_file_size_limit *= 1.05;
     }
-    else if (fluid_opt.file_size_policy_opt == BUFFER)
+    else if (opt.file_size_policy_opt == BUFFER)
     {
-        this->rocksdb_compact_opt.output_file_size_limit = rocksdb_opt.write_buffer_size;
+        compact_opt.output_file_size_limit = rocksdb_opt.write_buffer_size;
     }
     else
     {
-        this->rocksdb_compact_opt.output_file_size_limit = fluid_opt.fixed_file_size;
+        compact_opt.output_file_size_limit = opt.fixed_file_size;
     }
 
-    this->meta_data_mutex.unlock();
-    spdlog::trace("Created CompactionTask L{} -> L{}", level_idx + 1, level_idx + 2);
-    return new CompactionTask(
-        db, this, cf_name, input_file_names, level_idx + 1, this->rocksdb_compact_opt, level_idx, false, false);
+    return compact_opt;
 }
 
 
 void FluidLSMCompactor::OnFlushCompleted(rocksdb::DB *db, const ROCKSDB_NAMESPACE::FlushJobInfo &info)
 {
-    int largest_level_idx = this->largest_occupied_level(db);
+    this->init_level_view(db);
+    uint64_t flushed_bytes = this->add_file_to_view(0, info.file_path);
+    this->update_write_pressure();
+    int largest_level_idx = this->largest_occupied_level_idx();
+    this->debt.record_flush(flushed_bytes, this->rocksdb_opt.env->NowMicros());
+    bool stall_approaching = info.triggered_writes_slowdown || (this->debt.get_write_pressure() > 0);
 
     for (int level_idx = largest_level_idx; level_idx > -1; level_idx--)
     {
@@ -123,7 +570,7 @@ void FluidLSMCompactor::OnFlushCompleted(rocksdb::DB *db, const ROCKSDB_NAMESPAC
 
         if (!task) {continue;}
 
-        task->retry_on_fail = info.triggered_writes_slowdown;
+        task->retry_on_fail = stall_approaching;
         ScheduleCompaction(task);
     }
 
@@ -131,6 +578,32 @@ void FluidLSMCompactor::OnFlushCompleted(rocksdb::DB *db, const ROCKSDB_NAMESPAC
 }
 
 
+void FluidLSMCompactor::OnCompactionCompleted(rocksdb::DB *db, const ROCKSDB_NAMESPACE::CompactionJobInfo &info)
+{
+    if (!info.status.ok()) {return;}
+    this->debt.record_compaction(info.stats.total_input_bytes, info.stats.elapsed_micros);
+
+    if (!this->level_view_initialized)
+    {
+        // Meta data already reflects this compaction
+        this->init_level_view(db);
+        return;
+    }
+
+    for (auto &file_path : info.input_files)
+    {
+        this->remove_file_from_view(file_path);
+    }
+    for (auto &file_path : info.output_files)
+    {
+        this->add_file_to_view(info.output_level, file_path);
+    }
+    this->update_write_pressure();
+
+    return;
+}
+
+
 void FluidLSMCompactor::CompactFiles(void *arg)
 {
     std::unique_ptr<CompactionTask> task(reinterpret_cast<CompactionTask *>(arg));
@@ -138,14 +611,18 @@ void FluidLSMCompactor::CompactFiles(void *arg)
     assert(task->db);
     assert(task->output_level > (int) task->origin_level_id);
 
-    std::vector<std::string> *output_file_names = new std::vector<std::string>();
-    rocksdb::Status s = task->db->CompactFiles(
-        task->compact_options,
-        task->input_file_names,
-        task->output_level,
-        -1,
-        output_file_names
-    );
+    FluidLSMCompactor *compactor = (FluidLSMCompactor *) task->compactor;
+    rocksdb::Status s;
+    if (!compactor->trivial_move(task.get()))
+    {
+        // One CompactFiles call per task. Splitting it by key range does not pay off here: with uniform keys every
+        // flushed file spans the whole key domain and adjacent levels chain into a single range, while the engine's
+        // own subcompactions and atomic installs are not reachable with kCompactionStyleNone.
+        std::vector<std::string> output_file_names;
+        s = task->db->CompactFiles(
+            task->compact_options, task->input_file_names, task->output_level, -1, &output_file_names);
+    }
+    compactor->release_files(task->input_file_names);
 
     if (!s.ok() && !s.IsIOError() && task->retry_on_fail && !s.IsInvalidArgument())
     {
@@ -163,32 +640,164 @@ void FluidLSMCompactor::CompactFiles(void *arg)
             task->column_family_name,
             task->origin_level_id
         );
-        new_task->is_a_retry = true;
-        task->compactor->ScheduleCompaction(new_task);
+        if (new_task)
+        {
+            new_task->is_a_retry = true;
+            task->compactor->ScheduleCompaction(new_task);
 
-        return;
+            return;
+        }
     }
 
     spdlog::trace("CompactFiles L{} -> L{} finished | Status: {}",
                   task->origin_level_id + 1, task->output_level + 1, s.ToString());
-    ((FluidLSMCompactor *) task->compactor)->compactions_left_count--;
+    compactor->compaction_finished(task->origin_level_id);
+
+    // Migration compactions only run on an idle compactor, this may be the moment to start the next one
+    if (s.ok() && compactor->migration_in_progress())
+    {
+        compactor->requires_compaction(task->db);
+    }
 
     return;
 }
 
 
+void FluidLSMCompactor::DropCompaction(void *arg)
+{
+    std::unique_ptr<CompactionTask> task(reinterpret_cast<CompactionTask *>(arg));
+    FluidLSMCompactor *compactor = (FluidLSMCompactor *) task->compactor;
+
+    spdlog::trace("Dropping CompactionTask L{} -> L{}", task->origin_level_id + 1, task->output_level + 1);
+    compactor->release_files(task->input_file_names);
+    compactor->compaction_finished(task->origin_level_id);
+}
+
+
+bool FluidLSMCompactor::trivial_move(CompactionTask *task)
+{
+    if ((task->origin_level_id != 0) || (task->output_level != 1) || (task->column_family_name != "default"))
+    {
+        return false;
+    }
+
+    // PromoteL0 moves the entire first level, so the task must own all of it and the next level must be empty
+    if (this->level_view.size() <= (size_t) task->output_level) {return false;}
+    LevelShape &source = this->level_view[0];
+    LevelShape &target = this->level_view[task->output_level];
+    {
+        std::lock(source.mutex, target.mutex);
+        std::lock_guard<std::mutex> source_lock(source.mutex, std::adopt_lock);
+        std::lock_guard<std::mutex> target_lock(target.mutex, std::adopt_lock);
+        if (!target.files.empty() || (source.files.size() != task->input_file_names.size())) {return false;}
+    }
+
+    rocksdb::ColumnFamilyMetaData cf_meta;
+    task->db->GetColumnFamilyMetaData(&cf_meta);
+    std::vector<const rocksdb::SstFileMetaData *> files;
+    for (auto &file : cf_meta.levels[0].files)
+    {
+        files.push_back(&file);
+    }
+    std::sort(files.begin(), files.end(), [](const rocksdb::SstFileMetaData *lhs, const rocksdb::SstFileMetaData *rhs) {
+        return lhs->smallestkey < rhs->smallestkey;
+    });
+    for (size_t file_idx = 1; file_idx < files.size(); file_idx++)
+    {
+        if (files[file_idx]->smallestkey <= files[file_idx - 1]->largestkey) {return false;}
+    }
+
+    rocksdb::Status s = task->db->PromoteL0(task->db->DefaultColumnFamily(), task->output_level);
+    if (!s.ok())
+    {
+        spdlog::debug("Trivial move L1 -> L2 not possible, rewriting files: {}", s.ToString());
+        return false;
+    }
+
+    spdlog::trace("Trivially moved {} files L1 -> L2", task->input_file_names.size());
+    // Flushes may have landed in the first level since the check, reload both levels rather than swapping them
+    this->refresh_level_view(task->db, 0, task->output_level + 1);
+
+    return true;
+}
+
+
 void FluidLSMCompactor::ScheduleCompaction(CompactionTask *task)
 {
+    size_t level_idx = task->origin_level_id;
     if (!task->is_a_retry)
     {
-        this->compactions_left_count++;
+        this->compaction_started(level_idx);
+    }
+
+    if (!this->scheduler.submit(task))
+    {
+        // Task was folded into a pending one of the same levels, a single compaction now stands for both
+        this->compaction_finished(level_idx);
     }
-    this->rocksdb_opt.env->Schedule(&FluidLSMCompactor::CompactFiles, task);
 
     return;
 }
 
 
+void FluidLSMCompactor::compaction_started(size_t level_idx)
+{
+    std::lock_guard<std::mutex> lock(this->compactions_left_mutex);
+    if (level_idx >= this->compactions_left_per_level.size())
+    {
+        this->compactions_left_per_level.resize(level_idx + 1, 0);
+    }
+    this->compactions_left_per_level[level_idx]++;
+    this->compactions_left_count++;
+}
+
+
+void FluidLSMCompactor::compaction_finished(size_t level_idx)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->compactions_left_mutex);
+        assert(level_idx < this->compactions_left_per_level.size());
+        this->compactions_left_per_level[level_idx]--;
+        this->compactions_left_count--;
+    }
+    this->compactions_left_cv.notify_all();
+}
+
+
+void FluidLSMCompactor::wait_for_compactions()
+{
+    std::unique_lock<std::mutex> lock(this->compactions_left_mutex);
+    this->compactions_left_cv.wait(lock, [this] { return this->compactions_left_count == 0; });
+}
+
+
+bool FluidLSMCompactor::wait_for_compactions(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(this->compactions_left_mutex);
+    return this->compactions_left_cv.wait_for(lock, timeout, [this] { return this->compactions_left_count == 0; });
+}
+
+
+void FluidLSMCompactor::wait_for_level_compactions(size_t level_idx)
+{
+    std::unique_lock<std::mutex> lock(this->compactions_left_mutex);
+    this->compactions_left_cv.wait(lock, [this, level_idx] {
+        return (level_idx >= this->compactions_left_per_level.size())
+            || (this->compactions_left_per_level[level_idx] == 0);
+    });
+}
+
+
+bool FluidLSMCompactor::wait_for_level_compactions(size_t level_idx, std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(this->compactions_left_mutex);
+    return this->compactions_left_cv.wait_for(lock, timeout, [this, level_idx] {
+        return (level_idx >= this->compactions_left_per_level.size())
+            || (this->compactions_left_per_level[level_idx] == 0);
+    });
+}
+
+
 size_t FluidLSMCompactor::estimate_levels(size_t N, double T, size_t E, size_t B)
 {
     if ((N * E) < B)
@@ -203,11 +812,38 @@ size_t FluidLSMCompactor::estimate_levels(size_t N, double T, size_t E, size_t B
 }
 
 
+size_t FluidLSMCompactor::estimate_levels(size_t N, const FluidOptions &fluid_opt)
+{
+    size_t E = fluid_opt.entry_size;
+    if ((N * E) < fluid_opt.buffer_size)
+    {
+        spdlog::warn("Number of entries (N = {}) fits in the in-memory buffer, defaulting to 1 level", N);
+        return 1;
+    }
+
+    // Smallest number of levels whose combined capacity holds every entry
+    size_t estimated_levels = 0;
+    double tree_capacity = 0;
+    while (tree_capacity < static_cast<double>(N) * E)
+    {
+        uint64_t level_capacity = fluid_opt.level_capacity(estimated_levels);
+        if (level_capacity == 0)
+        {
+            // Only an invalid shape (some T_i <= 1) stops levels from growing, see FluidOptions::shape_valid
+            spdlog::error("Level {} has no capacity, stopping the level estimate", estimated_levels + 1);
+            return std::max<size_t>(estimated_levels, 1);
+        }
+        tree_capacity += level_capacity;
+        estimated_levels++;
+    }
+
+    return estimated_levels;
+}
+
+
 bool FluidLSMCompactor::requires_compaction(rocksdb::DB *db)
 {
-    this->meta_data_mutex.lock();
     int largest_level_idx = this->largest_occupied_level(db);
-    this->meta_data_mutex.unlock();
     bool task_scheduled = false;
 
     for (int level_idx = largest_level_idx; level_idx > -1; level_idx--)
@@ -234,5 +870,18 @@ size_t FluidLSMCompactor::calculate_full_tree(double T, size_t E, size_t B, size
         full_tree_size += entries_in_buffer * (T - 1) * (std::pow(T, level - 1));
     }
 
+    return full_tree_size;
+}
+
+
+size_t FluidLSMCompactor::calculate_full_tree(const FluidOptions &fluid_opt, size_t L)
+{
+    size_t full_tree_size = 0;
+
+    for (size_t level_idx = 0; level_idx < L; level_idx++)
+    {
+        full_tree_size += fluid_opt.level_capacity(level_idx) / fluid_opt.entry_size;
+    }
+
     return full_tree_size;
 }
\ No newline at end of file
@@ -1,17 +1,23 @@
 #ifndef FLUID_LSM_COMPACTOR_H_
 #define FLUID_LSM_COMPACTOR_H_
 
+#include <algorithm>
 #include <cmath>
 #include <set>
 #include <mutex>
 #include <vector>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <unordered_map>
 
 #include "rocksdb/db.h"
 #include "rocksdb/env.h"
 #include "rocksdb/listener.h"
 
 #include "spdlog/spdlog.h"
+#include "tmpdb/compaction_debt.hpp"
+#include "tmpdb/compaction_scheduler.hpp"
 #include "tmpdb/fluid_options.hpp"
 
 namespace tmpdb
@@ -24,13 +30,14 @@ typedef struct CompactionTask
 {
 rocksdb::DB *db;
 FluidCompactor *compactor;
-const std::string &column_family_name;
+std::string column_family_name; //> by value, tasks outlive the event that picked them
 std::vector<std::string> input_file_names;
 int output_level;
 rocksdb::CompactionOptions compact_options;
 size_t origin_level_id;
 bool retry_on_fail;
 bool is_a_retry;
+double priority; //> level pressure, higher priority tasks are dispatched first
 
 /**
  * @brief Construct a new Compaction Task object
@@ -62,10 +69,29 @@ CompactionTask(
         compact_options(compact_options),
         origin_level_id(origin_level_id),
         retry_on_fail(retry_on_fail),
-        is_a_retry(is_a_retry) {}
+        is_a_retry(is_a_retry),
+        priority(0) {}
 } CompactionTask;
 
 
+typedef struct FileShape
+{
+std::string name;
+uint64_t size;
+bool being_compacted; //> claimed by a compaction task picked by this compactor
+} FileShape;
+
+
+typedef struct LevelShape
+{
+std::mutex mutex; //> guards every other member
+std::vector<FileShape> files;
+uint64_t bytes = 0;
+size_t files_being_compacted = 0;
+uint64_t bytes_being_compacted = 0;
+} LevelShape;
+
+
 class FluidCompactor : public ROCKSDB_NAMESPACE::EventListener
 {
 public:
@@ -107,16 +133,43 @@ class FluidLSMCompactor : public FluidCompactor
 public:
     std::mutex compactions_left_mutex;
     std::mutex meta_data_mutex;
+    std::mutex fluid_opt_mutex; //> guards fluid_opt once compactions run concurrently with update_options
+    std::condition_variable compactions_left_cv;
     std::atomic<int> compactions_left_count;
+    std::vector<int> compactions_left_per_level; //> guarded by compactions_left_mutex
+    CompactionScheduler scheduler;
+    CompactionDebt debt;
+
+    // Per level view of the tree (runs, bytes, claimed files) maintained from flush and compaction events so picking
+    // a compaction never has to copy the column family meta data. Each level is locked independently, while
+    // meta_data_mutex only serializes (re)loading the view from the meta data.
+    std::vector<LevelShape> level_view;
+    std::atomic<bool> level_view_initialized;
+
+    // Shape migration state, guarded by fluid_opt_mutex. Levels flagged as migrating are held to the limits of
+    // migration_source until they converge to fluid_opt, the vector is empty once every level has converged.
+    FluidOptions migration_source;
+    std::vector<bool> level_migrating;
 
     /**
      * @brief Construct a new FluidLSMCompactor object
      * 
      * @param fluid_opt 
      * @param rocksdb_opt 
+     * @param compaction_threads Number of workers running compactions, ordered by level pressure
      */
-    FluidLSMCompactor(const FluidOptions fluid_opt, const rocksdb::Options rocksdb_opt)
-        : FluidCompactor(fluid_opt, rocksdb_opt), compactions_left_count(0) {};
+    FluidLSMCompactor(const FluidOptions fluid_opt, const rocksdb::Options rocksdb_opt, size_t compaction_threads = 1)
+        : FluidCompactor(fluid_opt, rocksdb_opt),
+        compactions_left_count(0),
+        compactions_left_per_level(std::max(rocksdb_opt.num_levels, 1), 0),
+        scheduler(&FluidLSMCompactor::CompactFiles, compaction_threads, &FluidLSMCompactor::DropCompaction),
+        level_view(std::max(rocksdb_opt.num_levels, 1)),
+        level_view_initialized(false) {};
+
+    /**
+     * @brief Stops the scheduler before any member a running compaction may touch is destroyed
+     */
+    ~FluidLSMCompactor() {this->scheduler.shutdown();}
 
     /**
      * @brief 
@@ -124,7 +177,68 @@ public:
      * @param db 
      * @return int 
      */
-    int largest_occupied_level(rocksdb::DB *db) const;
+    int largest_occupied_level(rocksdb::DB *db);
+
+    /**
+     * @brief Rebuilds the level view from the column family meta data, keeping the claims of in-flight tasks.
+     *
+     * @param db
+     */
+    void refresh_level_view(rocksdb::DB *db);
+
+    /**
+     * @brief Releases the claim on files picked by a compaction task once it has finished or failed.
+     *
+     * @param file_names
+     */
+    void release_files(const std::vector<std::string> &file_names);
+
+    /**
+     * @brief Copy of the tree options currently steering compaction picks
+     */
+    FluidOptions current_options();
+
+    /**
+     * @brief Replaces the shape of the tree (T_i, K_i, Z and bits per element) used by subsequent compaction picks.
+     * Nothing is rewritten eagerly, levels converge to the new shape as they are naturally compacted.
+     *
+     * @param new_opt Options providing the new shape, every other field is ignored
+     */
+    void update_options(const FluidOptions &new_opt);
+
+    /**
+     * @brief Starts an incremental migration to a new tree shape, e.g. from leveling to tiering. Each level keeps
+     * the limits of its current shape and adopts the new one the next time it is compacted anyway. Levels that only
+     * need a compaction because of the new shape are compacted one at a time, and only while no other compaction is
+     * outstanding, which bounds the extra work the migration adds on top of the regular workload.
+     *
+     * @param target Options providing the new shape, every other field is ignored
+     */
+    void begin_migration(const FluidOptions &target);
+
+    /**
+     * @brief Whether some level has not yet converged to the shape set by begin_migration
+     */
+    bool migration_in_progress();
+
+    /**
+     * @brief Bytes currently stored on disk according to the level view
+     */
+    uint64_t tree_bytes();
+
+    /**
+     * @brief Bytes currently stored at every level according to the level view, empty until the view is loaded
+     */
+    std::vector<uint64_t> level_bytes();
+
+    /**
+     * @brief Write controller hook, called by writers after every write. Sleeps for a delay that grows smoothly with
+     * the number of files waiting in the first level, so writers slow down gradually instead of hitting the
+     * level0_slowdown_writes_trigger cliff.
+     *
+     * @param bytes Bytes just written
+     */
+    void throttle_write(size_t bytes);
 
     /**
      * @brief 
@@ -144,6 +258,14 @@ public:
      */
     void OnFlushCompleted(rocksdb::DB *db, const ROCKSDB_NAMESPACE::FlushJobInfo &info) override;
 
+    /**
+     * @brief Moves the input files of a finished compaction out of the level view and adds its outputs.
+     *
+     * @param db
+     * @param info
+     */
+    void OnCompactionCompleted(rocksdb::DB *db, const ROCKSDB_NAMESPACE::CompactionJobInfo &info) override;
+
     /**
      * @brief 
      * 
@@ -151,6 +273,14 @@ public:
      */
     static void CompactFiles(void *arg);
 
+    /**
+     * @brief Disposes of a task the scheduler will never run, releasing its files and its outstanding count so
+     * wait_for_compactions still returns
+     *
+     * @param arg
+     */
+    static void DropCompaction(void *arg);
+
     /**
      * @brief 
      * 
@@ -158,9 +288,64 @@ public:
      */
     void ScheduleCompaction(CompactionTask *task) override;
 
+    /**
+     * @brief Moves the inputs of a task to its output level without rewriting them when the files do not overlap
+     * each other nor anything in the output level. Only the first level can be moved through the public API
+     * (DB::PromoteL0), every other task is left to CompactFiles.
+     *
+     * @param task
+     * @return true if the files were moved and no compaction is needed
+     */
+    bool trivial_move(CompactionTask *task);
+
 
     bool requires_compaction(rocksdb::DB *db);
 
+    /**
+     * @brief Registers a compaction originating from level_idx as outstanding. Every call must be matched with a
+     * call to compaction_finished once the task is done (or dropped).
+     *
+     * @param level_idx Origin level of the compaction
+     */
+    void compaction_started(size_t level_idx);
+
+    /**
+     * @brief Marks a compaction originating from level_idx as done and wakes up any waiters.
+     *
+     * @param level_idx Origin level of the compaction
+     */
+    void compaction_finished(size_t level_idx);
+
+    /**
+     * @brief Blocks (without spinning) until every outstanding compaction has finished.
+     */
+    void wait_for_compactions();
+
+    /**
+     * @brief Blocks until every outstanding compaction has finished or the timeout expires.
+     *
+     * @param timeout Maximum time to wait
+     * @return true if all compactions finished, false on timeout
+     */
+    bool wait_for_compactions(std::chrono::milliseconds timeout);
+
+    /**
+     * @brief Blocks until every outstanding compaction originating from level_idx has finished.
+     *
+     * @param level_idx Origin level of the compactions to wait on
+     */
+    void wait_for_level_compactions(size_t level_idx);
+
+    /**
+     * @brief Blocks until every outstanding compaction originating from level_idx has finished or the timeout
+     * expires.
+     *
+     * @param level_idx Origin level of the compactions to wait on
+     * @param timeout Maximum time to wait
+     * @return true if all compactions of the level finished, false on timeout
+     */
+    bool wait_for_level_compactions(size_t level_idx, std::chrono::milliseconds timeout);
+
     /**
      * @brief Estimates the number of levels needed based on
      * 
@@ -172,7 +357,78 @@ public:
      */
     static size_t estimate_levels(size_t N, double T, size_t E, size_t B);
 
+    /**
+     * @brief Estimates the number of levels needed honoring per level size ratios (T_i)
+     *
+     * @param N Total number of entries
+     * @param fluid_opt Tree options providing E, B and T_i
+     * @return size_t Number of levels
+     */
+    static size_t estimate_levels(size_t N, const FluidOptions &fluid_opt);
+
     static size_t calculate_full_tree(double T, size_t E, size_t B, size_t L);
+
+    /**
+     * @brief Number of entries held by a full tree of L levels honoring per level size ratios (T_i)
+     *
+     * @param fluid_opt Tree options providing E, B and T_i
+     * @param L Number of levels
+     * @return size_t Number of entries
+     */
+    static size_t calculate_full_tree(const FluidOptions &fluid_opt, size_t L);
+
+    /**
+     * @brief Compaction options for merging level_idx into the next level, sized by the file size policy
+     *
+     * @param level_idx Level the merged data comes from
+     * @param last_level Whether level_idx is the last level (limits runs to Z instead of K)
+     * @return rocksdb::CompactionOptions
+     */
+    rocksdb::CompactionOptions compaction_options(size_t level_idx, bool last_level);
+
+private:
+    // The following helpers lock the levels they touch one at a time (refreshes a range of levels lowest first),
+    // callers must not hold any level mutex
+
+    void init_level_view(rocksdb::DB *db);
+
+    void load_level_view(rocksdb::DB *db); //> requires meta_data_mutex
+
+    /**
+     * @brief Reloads levels [first_level_idx, end_level_idx) from the column family meta data, e.g. after files moved
+     * between levels without a compaction event. Claims follow their files within the range. Takes meta_data_mutex.
+     */
+    void refresh_level_view(rocksdb::DB *db, size_t first_level_idx, size_t end_level_idx);
+
+    void load_levels(rocksdb::DB *db, size_t first_level_idx, size_t end_level_idx); //> requires meta_data_mutex
+
+    int largest_occupied_level_idx();
+
+    uint64_t add_file_to_view(size_t level_idx, const std::string &file_path);
+
+    void update_write_pressure();
+
+    void remove_file_from_view(const std::string &file_path);
+
+    /**
+     * @brief Whether a level with live_runs runs and level_size bytes exceeds the limits of the shape in opt
+     */
+    bool over_limit(const FluidOptions &opt, size_t level_idx, int largest_level_idx, int live_runs,
+        uint64_t level_size);
+
+    void finish_level_migration(size_t level_idx); //> takes fluid_opt_mutex
+
+    /**
+     * @brief Copies the shape of the tree (T_i, K_i, Z and bits per element) between options
+     */
+    static void copy_shape(const FluidOptions &from, FluidOptions &to);
+
+    /**
+     * @brief Names are kept as "/<number>.sst", the form returned by GetColumnFamilyMetaData
+     */
+    static std::string view_file_name(const std::string &file_path);
+
+    static uint64_t file_number(const std::string &file_name);
 };
 
 
@@ -33,25 +33,41 @@ bool FluidOptions::read_config(std::string config_path)
     this->levels = cfg["levels"];
     this->fixed_file_size = cfg["fixed_file_size"];
     this->file_size_policy_opt = cfg["file_size_policy_opt"];
+    this->partial_compaction = cfg.value("partial_compaction", false);
+    this->cascade_compaction = cfg.value("cascade_compaction", false);
+    this->size_ratio_per_level = cfg.value("size_ratio_per_level", std::vector<double>());
+    this->run_max_per_level = cfg.value("run_max_per_level", std::vector<int>());
 
-    return true;
+    return this->shape_valid();
 }
 
 
-bool FluidOptions::write_config(std::string config_path)
+static json config_json(const FluidOptions &opt)
 {
     json cfg;
-    cfg["size_ratio"] = this->size_ratio;
-    cfg["lower_level_run_max"] = this->lower_level_run_max;
-    cfg["largest_level_run_max"] = this->largest_level_run_max;
-    cfg["buffer_size"] = this->buffer_size;
-    cfg["entry_size"] = this->entry_size;
-    cfg["bits_per_element"] = this->bits_per_element;
-    cfg["bulk_load_opt"] = this->bulk_load_opt;
-    cfg["levels"] = this->levels;
-    cfg["num_entries"] = this->num_entries;
-    cfg["fixed_file_size"] = this->fixed_file_size;
-    cfg["file_size_policy_opt"] = this->file_size_policy_opt;
+    cfg["size_ratio"] = opt.size_ratio;
+    cfg["lower_level_run_max"] = opt.lower_level_run_max;
+    cfg["largest_level_run_max"] = opt.largest_level_run_max;
+    cfg["buffer_size"] = opt.buffer_size;
+    cfg["entry_size"] = opt.entry_size;
+    cfg["bits_per_element"] = opt.bits_per_element;
+    cfg["bulk_load_opt"] = opt.bulk_load_opt;
+    cfg["levels"] = opt.levels;
+    cfg["num_entries"] = opt.num_entries;
+    cfg["fixed_file_size"] = opt.fixed_file_size;
+    cfg["file_size_policy_opt"] = opt.file_size_policy_opt;
+    cfg["partial_compaction"] = opt.partial_compaction;
+    cfg["cascade_compaction"] = opt.cascade_compaction;
+    cfg["size_ratio_per_level"] = opt.size_ratio_per_level;
+    cfg["run_max_per_level"] = opt.run_max_per_level;
+
+    return cfg;
+}
+
+
+bool FluidOptions::write_config(std::string config_path)
+{
+    json cfg = config_json(*this);
 
     std::ofstream out_cfg(config_path);
     if (!out_cfg.is_open())
@@ -64,4 +80,82 @@ bool FluidOptions::write_config(std::string config_path)
     spdlog::info("Writing configuration file at {}", config_path);
 
     return true;
-}
\ No newline at end of file
+}
+
+
+std::string FluidOptions::config_string() const
+{
+    return config_json(*this).dump();
+}
+
+
+double FluidOptions::level_size_ratio(size_t level_idx) const
+{
+    if (level_idx < this->size_ratio_per_level.size())
+    {
+        return this->size_ratio_per_level[level_idx];
+    }
+
+    return this->size_ratio;
+}
+
+
+int FluidOptions::level_run_max(size_t level_idx, bool last_level) const
+{
+    if (last_level)
+    {
+        return this->largest_level_run_max;
+    }
+    if (level_idx < this->run_max_per_level.size())
+    {
+        return this->run_max_per_level[level_idx];
+    }
+
+    return this->lower_level_run_max;
+}
+
+
+uint64_t FluidOptions::level_capacity(size_t level_idx) const
+{
+    double capacity = (this->level_size_ratio(0) - 1) * this->buffer_size;
+    for (size_t idx = 1; idx <= level_idx; idx++)
+    {
+        capacity *= this->level_size_ratio(idx);
+    }
+
+    return static_cast<uint64_t>(capacity);
+}
+
+
+bool FluidOptions::shape_valid() const
+{
+    bool valid = true;
+    if (this->size_ratio <= 1)
+    {
+        spdlog::error("Size ratio must be greater than 1, got {}", this->size_ratio);
+        valid = false;
+    }
+    for (size_t level_idx = 0; level_idx < this->size_ratio_per_level.size(); level_idx++)
+    {
+        if (this->size_ratio_per_level[level_idx] > 1) {continue;}
+        spdlog::error("Size ratio of level {} must be greater than 1, got {}",
+            level_idx + 1, this->size_ratio_per_level[level_idx]);
+        valid = false;
+    }
+
+    if ((this->lower_level_run_max < 1) || (this->largest_level_run_max < 1))
+    {
+        spdlog::error("File limits must be at least 1, got K = {} and Z = {}",
+            this->lower_level_run_max, this->largest_level_run_max);
+        valid = false;
+    }
+    for (size_t level_idx = 0; level_idx < this->run_max_per_level.size(); level_idx++)
+    {
+        if (this->run_max_per_level[level_idx] >= 1) {continue;}
+        spdlog::error("File limit of level {} must be at least 1, got {}",
+            level_idx + 1, this->run_max_per_level[level_idx]);
+        valid = false;
+    }
+
+    return valid;
+}
@@ -6,6 +6,7 @@
 #include <cstdlib>
 #include <limits>
 #include <string>
+#include <vector>
 
 #include "spdlog/spdlog.h"
 #include "nlohmann/json.hpp"
@@ -29,6 +30,12 @@ public:
     bulk_load_type bulk_load_opt = ENTRIES;
     file_size_policy file_size_policy_opt = INCREASING;
     uint64_t fixed_file_size = std::numeric_limits<uint64_t>::max(); //> default MAX size
+    bool partial_compaction = false;            //> FIXED/BUFFER only, compact just enough files to fit the level
+    bool cascade_compaction = false;            //> merge L_i and L_i+1 into L_i+2 when both would overflow
+
+    // Optional per level overrides, levels past the end of a vector fall back to the scalar options above
+    std::vector<double> size_ratio_per_level;   //> (T_i) ratio between the capacity of level i and level i - 1
+    std::vector<int> run_max_per_level;         //> (K_i) runs allowed at level i, the last level always uses Z
 
     size_t num_entries = 0;
     size_t levels = 0;
@@ -42,6 +49,39 @@ public:
     bool read_config(std::string config_path);
 
     bool write_config(std::string config_path);
+
+    /**
+     * @brief The config write_config writes on a single line, keys in sorted order so equal options give equal strings
+     */
+    std::string config_string() const;
+
+    /**
+     * @brief Size ratio (T_i) of a level
+     *
+     * @param level_idx Level id (0 is the first on disk level)
+     */
+    double level_size_ratio(size_t level_idx) const;
+
+    /**
+     * @brief Maximum number of runs (K_i, or Z for the last level) of a level
+     *
+     * @param level_idx Level id (0 is the first on disk level)
+     * @param last_level Whether level_idx is the last level of the tree
+     */
+    int level_run_max(size_t level_idx, bool last_level) const;
+
+    /**
+     * @brief Capacity of a level in bytes, (T_0 - 1) * B for the first level and T_i times the previous one after
+     *
+     * @param level_idx Level id (0 is the first on disk level)
+     */
+    uint64_t level_capacity(size_t level_idx) const;
+
+    /**
+     * @brief Checks that every level grows (T and each T_i greater than 1) and holds at least one run (K, Z and each
+     * K_i at least 1), logging every violation. Level capacities only grow with a valid shape.
+     */
+    bool shape_valid() const;
 };
 
 } /* namespace tmpdb */
@@ -0,0 +1,257 @@
+#ifndef LSM_COST_MODEL_H_
+#define LSM_COST_MODEL_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "tmpdb/fluid_options.hpp"
+
+namespace tmpdb
+{
+
+/**
+ * @brief Fraction of empty reads (z0), non-empty reads (z1), range reads (q) and writes (w) in a workload
+ */
+typedef struct WorkloadMix
+{
+double z0;
+double z1;
+double q;
+double w;
+} WorkloadMix;
+
+
+/**
+ * @brief Relative cost of page I/O on the storage device, all 1 counts I/Os
+ */
+typedef struct DeviceCosts
+{
+double read_cost = 1.0;             //> random page read, paid by lookups
+double write_cost = 1.0;            //> sequential page write, paid by flushes and compactions
+double sequential_read_cost = 1.0;  //> sequential page read, paid by compactions
+size_t page_size = 4096;            //> bytes
+} DeviceCosts;
+
+
+/**
+ * @brief Expected I/O per operation of a Fluid LSM tree holding N entries, following the metrics recorded by the
+ * experiments (z0, z1, q, w). Bloom filters are sized per level with Monkey, i.e. the total filter memory
+ * (bits_per_element * N) is split so that the sum of false positive rates over all runs is minimal.
+ */
+class LSMCostModel
+{
+public:
+    /**
+     * @brief Construct a new LSMCostModel object
+     *
+     * @param opt Shape of the tree (T_i, K_i, Z, B, E, h)
+     * @param num_entries Entries in the tree (N)
+     * @param device Device read and write costs
+     */
+    LSMCostModel(const FluidOptions &opt, size_t num_entries, DeviceCosts device = DeviceCosts())
+        : opt(opt), num_entries(num_entries), device(device)
+    {
+        double remaining = static_cast<double>(num_entries);
+        for (size_t level_idx = 0; remaining > 0; level_idx++)
+        {
+            double level_entries = std::min<double>(opt.level_capacity(level_idx) / opt.entry_size, remaining);
+            if (opt.level_capacity(level_idx) == 0) {level_entries = remaining;}
+            this->entries_per_level.push_back(level_entries);
+            remaining -= level_entries;
+        }
+
+        size_t levels = this->entries_per_level.size();
+        for (size_t level_idx = 0; level_idx < levels; level_idx++)
+        {
+            this->runs_per_level.push_back(opt.level_run_max(level_idx, level_idx == levels - 1));
+        }
+        this->fpr_per_level = LSMCostModel::monkey_false_positive_rates(this->entries_per_level,
+            this->runs_per_level, opt.bits_per_element * num_entries);
+    }
+
+    /**
+     * @brief Construct a new LSMCostModel object for a tree whose levels are not full, e.g. one observed or simulated
+     *
+     * @param opt Shape of the tree, only T_i, B, E and h are used
+     * @param entries_per_level Entries at each level
+     * @param runs_per_level Sorted runs at each level
+     * @param device Device read and write costs
+     */
+    LSMCostModel(const FluidOptions &opt, const std::vector<double> &entries_per_level,
+        const std::vector<double> &runs_per_level, DeviceCosts device = DeviceCosts())
+        : opt(opt), num_entries(0), device(device), entries_per_level(entries_per_level), runs_per_level(runs_per_level)
+    {
+        for (auto &level_entries : entries_per_level)
+        {
+            this->num_entries += level_entries;
+        }
+        this->fpr_per_level = LSMCostModel::monkey_false_positive_rates(this->entries_per_level,
+            this->runs_per_level, opt.bits_per_element * this->num_entries);
+    }
+
+    size_t levels() const {return this->entries_per_level.size();}
+
+    /**
+     * @brief False positive rate of the filters of every run at a level
+     */
+    double false_positive_rate(size_t level_idx) const {return this->fpr_per_level[level_idx];}
+
+    /**
+     * @brief Expected I/Os of a lookup on a key that does not exist, one per false positive
+     */
+    double empty_read_cost() const
+    {
+        double cost = 0;
+        for (size_t level_idx = 0; level_idx < this->levels(); level_idx++)
+        {
+            cost += this->runs_per_level[level_idx] * this->fpr_per_level[level_idx];
+        }
+
+        return cost * this->device.read_cost;
+    }
+
+    /**
+     * @brief Expected I/Os of a lookup on an existing key chosen uniformly. The key lives at level j with probability
+     * n_j / N, in any of its runs with equal probability, so false positives are paid on every run probed before it.
+     */
+    double non_empty_read_cost() const
+    {
+        double cost = 0;
+        double false_positives_above = 0;
+        for (size_t level_idx = 0; level_idx < this->levels(); level_idx++)
+        {
+            double runs = this->runs_per_level[level_idx];
+            double fpr = this->fpr_per_level[level_idx];
+            double level_prob = this->entries_per_level[level_idx] / this->num_entries;
+            cost += level_prob * (1 + false_positives_above + ((runs - 1) / 2) * fpr);
+            false_positives_above += runs * fpr;
+        }
+
+        return cost * this->device.read_cost;
+    }
+
+    /**
+     * @brief Expected I/Os of a short range read (at most a page of entries), one seek per run
+     */
+    double range_read_cost() const
+    {
+        double runs = 0;
+        for (auto &run_max : this->runs_per_level)
+        {
+            runs += run_max;
+        }
+
+        return runs * this->device.read_cost;
+    }
+
+    /**
+     * @brief Amortized I/Os of a write. Each page is read and written once per merge, and a level with K_i runs
+     * merges an entry (T_i - 1) / (K_i + 1) times before it moves down.
+     */
+    double write_cost() const
+    {
+        double entries_per_page = std::max(1.0, static_cast<double>(this->device.page_size) / this->opt.entry_size);
+        double merges = 0;
+        for (size_t level_idx = 0; level_idx < this->levels(); level_idx++)
+        {
+            merges += (this->opt.level_size_ratio(level_idx) - 1) / (this->runs_per_level[level_idx] + 1);
+        }
+
+        return (merges / entries_per_page) * (this->device.sequential_read_cost + this->device.write_cost);
+    }
+
+    /**
+     * @brief Expected cost per operation of a workload
+     */
+    double cost(const WorkloadMix &mix) const
+    {
+        return (mix.z0 * this->empty_read_cost()) + (mix.z1 * this->non_empty_read_cost())
+            + (mix.q * this->range_read_cost()) + (mix.w * this->write_cost());
+    }
+
+    /**
+     * @brief Monkey allocation of filter memory across levels. Minimizing sum(a_i * r_i * p_i) under the memory
+     * budget sum(n_i * -ln(p_i)) = M * ln(2)^2 gives p_i = c * n_i / (a_i * r_i). Levels where that reaches 1 get no
+     * filter and are dropped from the budget.
+     *
+     * @param entries_per_level Entries at each level (n_i), levels with no entries get no filter
+     * @param runs_per_level Runs probed at each level (r_i)
+     * @param memory_bits Total filter memory (M)
+     * @param access_weights Fraction of lookups probing each level (a_i), empty for uniform access where every
+     * lookup may probe every level
+     * @return std::vector<double> False positive rate of the filters at each level
+     */
+    static std::vector<double> monkey_false_positive_rates(
+        const std::vector<double> &entries_per_level,
+        const std::vector<double> &runs_per_level,
+        double memory_bits,
+        const std::vector<double> &access_weights = std::vector<double>())
+    {
+        size_t levels = entries_per_level.size();
+        std::vector<double> fprs(levels, 1.0);
+        std::vector<bool> filtered(levels, true);
+        double memory = memory_bits * std::pow(std::log(2), 2);
+        std::vector<double> probes(levels);
+        for (size_t level_idx = 0; level_idx < levels; level_idx++)
+        {
+            double weight = (level_idx < access_weights.size()) ? access_weights[level_idx] : 1.0;
+            probes[level_idx] = weight * runs_per_level[level_idx];
+            filtered[level_idx] = (entries_per_level[level_idx] > 0) && (probes[level_idx] > 0);
+        }
+
+        bool capped = true;
+        while (capped)
+        {
+            capped = false;
+            double filtered_entries = 0;
+            double weighted_log_sum = 0;
+            for (size_t level_idx = 0; level_idx < levels; level_idx++)
+            {
+                if (!filtered[level_idx]) {continue;}
+                double n = entries_per_level[level_idx];
+                filtered_entries += n;
+                weighted_log_sum += n * std::log(n / probes[level_idx]);
+            }
+            if (filtered_entries == 0) {break;}
+
+            double log_c = -(memory + weighted_log_sum) / filtered_entries;
+            for (size_t level_idx = 0; level_idx < levels; level_idx++)
+            {
+                if (!filtered[level_idx]) {continue;}
+                fprs[level_idx] = std::exp(log_c) * entries_per_level[level_idx] / probes[level_idx];
+                if (fprs[level_idx] >= 1)
+                {
+                    fprs[level_idx] = 1.0;
+                    filtered[level_idx] = false;
+                    capped = true;
+                }
+            }
+        }
+
+        return fprs;
+    }
+
+    /**
+     * @brief Bits per key a bloom filter needs to reach a false positive rate, 0 for no filter
+     */
+    static double bits_per_key(double false_positive_rate)
+    {
+        if (false_positive_rate >= 1) {return 0;}
+
+        return -std::log(false_positive_rate) / std::pow(std::log(2), 2);
+    }
+
+private:
+    FluidOptions opt;
+    double num_entries;
+    DeviceCosts device;
+
+    std::vector<double> entries_per_level;
+    std::vector<double> runs_per_level;
+    std::vector<double> fpr_per_level;
+};
+
+} /* namespace tmpdb */
+
+#endif /* LSM_COST_MODEL_H_ */
@@ -0,0 +1,409 @@
+#include "tmpdb/lsm_simulator.hpp"
+
+using namespace tmpdb;
+
+
+LSMSimulator::LSMSimulator(const FluidOptions &opt, size_t key_domain, size_t max_levels, DeviceCosts device)
+    : opt(opt), key_domain(static_cast<double>(key_domain)), max_levels(std::max<size_t>(max_levels, 1)),
+    device(device), tree(1) {}
+
+
+void LSMSimulator::bulk_load(size_t num_entries, bool stop_after_level_filled)
+{
+    // Same estimate as FluidLSMCompactor::estimate_levels, smallest tree whose capacity holds every entry
+    size_t num_levels = 1;
+    if (static_cast<double>(num_entries) * this->opt.entry_size >= this->opt.buffer_size)
+    {
+        double tree_capacity = 0;
+        for (num_levels = 0; tree_capacity < static_cast<double>(num_entries) * this->opt.entry_size; num_levels++)
+        {
+            uint64_t level_capacity = this->opt.level_capacity(num_levels);
+            if (level_capacity == 0)
+            {
+                spdlog::error("Level {} has no capacity, stopping the level estimate", num_levels + 1);
+                num_levels = std::max<size_t>(num_levels, 1);
+                break;
+            }
+            tree_capacity += level_capacity;
+        }
+    }
+    if (num_levels > this->max_levels)
+    {
+        spdlog::warn("Bulk load needs {} levels, only {} are available", num_levels, this->max_levels);
+        num_levels = this->max_levels;
+    }
+    this->tree.resize(std::max(this->tree.size(), num_levels));
+
+    size_t num_entries_loaded = 0;
+    for (size_t level = num_levels; level > 0; level--)
+    {
+        size_t level_idx = level - 1;
+        size_t level_entries = this->opt.level_capacity(level_idx) / this->opt.entry_size;
+        if (level_entries == 0) {continue;}
+
+        size_t num_runs = this->opt.level_run_max(level_idx, level == num_levels);
+        double entries_per_run = static_cast<double>(level_entries / num_runs);
+        if (level_idx == 0)
+        {
+            // Flushed runs are left as is
+            for (size_t run_idx = 0; run_idx < num_runs; run_idx++)
+            {
+                this->tree[level_idx].push_back({entries_per_run, 1});
+            }
+        }
+        else
+        {
+            double run_entries = entries_per_run * num_runs;
+            size_t files = num_runs;
+            if (this->opt.file_size_policy_opt != INCREASING)
+            {
+                double file_size = (this->opt.file_size_policy_opt == BUFFER) ? this->opt.buffer_size
+                    : this->opt.fixed_file_size;
+                files = std::max<size_t>(1, std::ceil(run_entries * this->opt.entry_size / file_size));
+            }
+            this->tree[level_idx].push_back({run_entries, files});
+        }
+
+        num_entries_loaded += level_entries;
+        if (stop_after_level_filled && num_entries_loaded > num_entries) {break;}
+    }
+
+    this->costs_valid = false;
+}
+
+
+void LSMSimulator::write(uint64_t count)
+{
+    uint64_t buffer_entries = std::max<uint64_t>(1, this->opt.buffer_size / this->opt.entry_size);
+    this->statistics.writes += count;
+    while (count > 0)
+    {
+        uint64_t taken = std::min(count, buffer_entries - this->buffered_entries);
+        this->buffered_entries += taken;
+        count -= taken;
+        if (this->buffered_entries >= buffer_entries)
+        {
+            this->flush();
+        }
+    }
+}
+
+
+void LSMSimulator::empty_read(uint64_t count)
+{
+    this->refresh_costs();
+    this->statistics.empty_reads += count;
+    this->statistics.empty_read_io += count * this->empty_read_cost;
+}
+
+
+void LSMSimulator::non_empty_read(uint64_t count)
+{
+    this->refresh_costs();
+    this->statistics.non_empty_reads += count;
+    this->statistics.non_empty_read_io += count * this->non_empty_read_cost;
+}
+
+
+void LSMSimulator::range_read(uint64_t count)
+{
+    this->refresh_costs();
+    this->statistics.range_reads += count;
+    this->statistics.range_read_io += count * this->range_read_cost;
+}
+
+
+void LSMSimulator::flush()
+{
+    if (this->buffered_entries == 0) {return;}
+
+    // Updates within the buffer are absorbed by the memtable
+    SimulatedRun buffer = {static_cast<double>(this->buffered_entries), 1};
+    SimulatedRun run = {this->merged_entries(std::vector<SimulatedRun>(1, buffer)), 1};
+    this->buffered_entries = 0;
+    this->tree[0].push_back(run);
+    this->statistics.flushes++;
+    this->statistics.bytes_flushed += run.entries * this->opt.entry_size;
+
+    // Same order as OnFlushCompleted, data merged down is only looked at again on the next flush
+    int largest_level_idx = this->largest_occupied_level_idx();
+    for (int level_idx = largest_level_idx; level_idx > -1; level_idx--)
+    {
+        this->compact_level(level_idx, largest_level_idx);
+    }
+
+    this->costs_valid = false;
+}
+
+
+bool LSMSimulator::compact_level(size_t level_idx, int largest_level_idx)
+{
+    if ((level_idx + 1 >= this->max_levels) || this->tree[level_idx].empty()) {return false;}
+    // Room for the output level (two levels down when cascading) before taking references into the tree
+    this->tree.resize(std::max(this->tree.size(), std::min(level_idx + 3, this->max_levels)));
+
+    std::vector<SimulatedRun> &level = this->tree[level_idx];
+    size_t live_runs = 0;
+    double level_entries = 0;
+    for (auto &run : level)
+    {
+        live_runs += run.files;
+        level_entries += run.entries;
+    }
+    double level_size = level_entries * this->opt.entry_size;
+
+    double bytes_to_pick = level_size;
+    if (this->opt.file_size_policy_opt == INCREASING)
+    {
+        // Every file counts as a run towards K_i (Z for the last level)
+        int run_max = this->opt.level_run_max(level_idx, (int) level_idx == largest_level_idx);
+        if ((int) live_runs <= run_max) {return false;}
+    }
+    else
+    {
+        // Compactions complete instantly, nothing arrives while one runs
+        double level_capacity = this->opt.level_capacity(level_idx);
+        if (level_size < level_capacity) {return false;}
+        if (this->opt.partial_compaction)
+        {
+            bytes_to_pick = std::min(level_size - level_capacity, level_size);
+        }
+    }
+    if (bytes_to_pick <= 0) {return false;}
+
+    // Files are taken oldest first. A run spans the whole key domain and its files split it evenly, so the inputs
+    // cover the fraction of the key domain given by the share of each run they take.
+    std::vector<SimulatedRun> inputs;
+    double picked_bytes = 0;
+    double key_fraction = 0;
+    while (!level.empty() && (picked_bytes < bytes_to_pick))
+    {
+        SimulatedRun &run = level.front();
+        double file_bytes = run.entries * this->opt.entry_size / run.files;
+        size_t files = std::min<size_t>(run.files, std::ceil((bytes_to_pick - picked_bytes) / file_bytes));
+        SimulatedRun picked = {run.entries * files / run.files, files};
+        picked_bytes += picked.entries * this->opt.entry_size;
+        key_fraction += static_cast<double>(files) / run.files;
+        inputs.push_back(picked);
+        if (files == run.files)
+        {
+            level.erase(level.begin());
+        }
+        else
+        {
+            run.entries -= picked.entries;
+            run.files -= files;
+        }
+    }
+
+    size_t output_level_idx = level_idx + 1;
+    if (this->opt.cascade_compaction && this->tree[level_idx].empty() && (level_idx + 2 < this->max_levels))
+    {
+        std::vector<SimulatedRun> &next_level = this->tree[level_idx + 1];
+        size_t next_files = 0;
+        double next_entries = 0;
+        for (auto &run : next_level)
+        {
+            next_files += run.files;
+            next_entries += run.entries;
+        }
+
+        bool next_level_overflows;
+        if (this->opt.file_size_policy_opt == INCREASING)
+        {
+            int next_run_max = this->opt.level_run_max(level_idx + 1, (int) level_idx + 1 == largest_level_idx);
+            next_level_overflows = (int) (next_files + 1) > next_run_max;
+        }
+        else
+        {
+            double next_level_size = next_entries * this->opt.entry_size;
+            next_level_overflows = (next_level_size + picked_bytes) > this->opt.level_capacity(level_idx + 1);
+        }
+
+        if (next_level_overflows && !next_level.empty())
+        {
+            inputs.insert(inputs.end(), next_level.begin(), next_level.end());
+            picked_bytes += next_entries * this->opt.entry_size;
+            key_fraction = 1;
+            next_level.clear();
+            output_level_idx = level_idx + 2;
+        }
+    }
+    key_fraction = std::min(key_fraction, 1.0);
+
+    // CompactFiles widens the inputs to every file of the output level overlapping their key range, which is what
+    // keeps a level with a single run leveled
+    std::vector<SimulatedRun> &output_level = this->tree[output_level_idx];
+    for (auto run = output_level.begin(); run != output_level.end();)
+    {
+        size_t files = std::min<size_t>(run->files, std::ceil(key_fraction * run->files) + 1);
+        if (key_fraction >= 1) {files = run->files;}
+        SimulatedRun overlapping = {run->entries * files / run->files, files};
+        picked_bytes += overlapping.entries * this->opt.entry_size;
+        inputs.push_back(overlapping);
+        if (files == run->files)
+        {
+            run = output_level.erase(run);
+        }
+        else
+        {
+            run->entries -= overlapping.entries;
+            run->files -= files;
+            run++;
+        }
+    }
+
+    double output_entries = this->merged_entries(inputs, key_fraction);
+    size_t files = this->output_files(
+        output_entries, output_level_idx - 1, (int) (output_level_idx - 1) == largest_level_idx);
+    if (output_level.empty())
+    {
+        output_level.push_back({output_entries, files});
+    }
+    else
+    {
+        // Only part of the key domain was rewritten, the output fills the gap it left in the oldest run
+        output_level.front().entries += output_entries;
+        output_level.front().files += files;
+    }
+
+    this->statistics.compactions++;
+    this->statistics.bytes_compacted_in += picked_bytes;
+    this->statistics.bytes_compacted_out += output_entries * this->opt.entry_size;
+
+    return true;
+}
+
+
+size_t LSMSimulator::output_files(double entries, size_t level_idx, bool last_level) const
+{
+    double file_size;
+    if (this->opt.file_size_policy_opt == INCREASING)
+    {
+        double level_capacity = this->opt.level_capacity(level_idx + 1);
+        file_size = 1.05 * level_capacity / this->opt.level_run_max(level_idx + 1, last_level);
+    }
+    else if (this->opt.file_size_policy_opt == BUFFER)
+    {
+        file_size = this->opt.buffer_size;
+    }
+    else
+    {
+        file_size = this->opt.fixed_file_size;
+    }
+    if (file_size <= 0) {return 1;}
+
+    return std::max<size_t>(1, std::ceil(entries * this->opt.entry_size / file_size));
+}
+
+
+double LSMSimulator::merged_entries(const std::vector<SimulatedRun> &runs, double key_fraction) const
+{
+    double entries = 0;
+    double key_domain = this->key_domain * key_fraction;
+    if (key_domain <= 0)
+    {
+        for (auto &run : runs)
+        {
+            entries += run.entries;
+        }
+        return entries;
+    }
+
+    // log of the probability that a key of the domain is in none of the runs
+    double log_missing = 0;
+    for (auto &run : runs)
+    {
+        log_missing += std::log1p(-std::min(run.entries / key_domain, 1.0));
+    }
+
+    return -std::expm1(log_missing) * key_domain;
+}
+
+
+int LSMSimulator::largest_occupied_level_idx() const
+{
+    for (size_t level_idx = this->tree.size(); level_idx > 0; level_idx--)
+    {
+        if (!this->tree[level_idx - 1].empty()) {return level_idx - 1;}
+    }
+
+    return 0;
+}
+
+
+std::vector<double> LSMSimulator::entries_per_level() const
+{
+    std::vector<double> entries(this->largest_occupied_level_idx() + 1, 0);
+    for (size_t level_idx = 0; level_idx < entries.size(); level_idx++)
+    {
+        for (auto &run : this->tree[level_idx])
+        {
+            entries[level_idx] += run.entries;
+        }
+    }
+
+    return entries;
+}
+
+
+std::vector<double> LSMSimulator::runs_per_level() const
+{
+    std::vector<double> runs(this->largest_occupied_level_idx() + 1, 0);
+    for (size_t level_idx = 0; level_idx < runs.size(); level_idx++)
+    {
+        runs[level_idx] = this->tree[level_idx].size();
+    }
+
+    return runs;
+}
+
+
+std::vector<size_t> LSMSimulator::files_per_level() const
+{
+    std::vector<size_t> files(this->largest_occupied_level_idx() + 1, 0);
+    for (size_t level_idx = 0; level_idx < files.size(); level_idx++)
+    {
+        for (auto &run : this->tree[level_idx])
+        {
+            files[level_idx] += run.files;
+        }
+    }
+
+    return files;
+}
+
+
+double LSMSimulator::write_amplification() const
+{
+    if (this->statistics.writes == 0) {return 0;}
+
+    double bytes_written = this->statistics.bytes_flushed + this->statistics.bytes_compacted_out;
+    return bytes_written / (static_cast<double>(this->statistics.writes) * this->opt.entry_size);
+}
+
+
+LSMCostModel LSMSimulator::cost_model() const
+{
+    return LSMCostModel(this->opt, this->entries_per_level(), this->runs_per_level(), this->device);
+}
+
+
+void LSMSimulator::refresh_costs()
+{
+    if (this->costs_valid) {return;}
+
+    std::vector<double> entries = this->entries_per_level();
+    if (std::all_of(entries.begin(), entries.end(), [](double level_entries) {return level_entries == 0;}))
+    {
+        this->empty_read_cost = this->non_empty_read_cost = this->range_read_cost = 0;
+    }
+    else
+    {
+        LSMCostModel model(this->opt, entries, this->runs_per_level(), this->device);
+        this->empty_read_cost = model.empty_read_cost();
+        this->non_empty_read_cost = model.non_empty_read_cost();
+        this->range_read_cost = model.range_read_cost();
+    }
+    this->costs_valid = true;
+}
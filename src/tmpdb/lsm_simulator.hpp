@@ -0,0 +1,162 @@
+#ifndef LSM_SIMULATOR_H_
+#define LSM_SIMULATOR_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+#include "tmpdb/fluid_options.hpp"
+#include "tmpdb/lsm_cost_model.hpp"
+
+namespace tmpdb
+{
+
+/**
+ * @brief A sorted run of the simulated tree, split into files by the file size policy
+ */
+typedef struct SimulatedRun
+{
+double entries; //> unique keys
+size_t files;
+} SimulatedRun;
+
+
+/**
+ * @brief Counters of a simulation. Read I/O is the expected cost of every lookup under the shape the tree had when it
+ * was issued.
+ */
+typedef struct SimulationStats
+{
+uint64_t writes = 0;
+uint64_t empty_reads = 0;
+uint64_t non_empty_reads = 0;
+uint64_t range_reads = 0;
+
+uint64_t flushes = 0;
+uint64_t compactions = 0;
+double bytes_flushed = 0;
+double bytes_compacted_in = 0;  //> read by compactions
+double bytes_compacted_out = 0; //> written by compactions
+
+double empty_read_io = 0;
+double non_empty_read_io = 0;
+double range_read_io = 0;
+} SimulationStats;
+
+
+/**
+ * @brief In memory model of the tree FluidLSMCompactor builds, for what-if analysis without touching RocksDB. The tree
+ * is tracked as runs per level and advanced one flush at a time: every flush adds a file to the first level and runs
+ * the same picks as OnFlushCompleted (largest level first, run limits with the increasing file size policy, level
+ * capacities otherwise, partial and cascading compactions), with compactions completing instantly. Reads never
+ * change the shape, hence their cost is looked up from the current shape and a batch of them is simulated at once.
+ *
+ * Runs are assumed to span the whole key domain, as with uniformly random keys, so a merge also rewrites the files of
+ * the output level covering the same share of the domain as its inputs.
+ */
+class LSMSimulator
+{
+public:
+    /**
+     * @brief Construct a new LSMSimulator object
+     *
+     * @param opt Tree options, including the file size policy
+     * @param key_domain Distinct keys writes are drawn uniformly from, updates are merged away by compactions. 0
+     * treats every write as a new key.
+     * @param max_levels Levels available to the tree, as rocksdb num_levels
+     * @param device Device costs weighing the expected read I/O
+     */
+    LSMSimulator(const FluidOptions &opt, size_t key_domain = 0, size_t max_levels = 16,
+        DeviceCosts device = DeviceCosts());
+
+    /**
+     * @brief Fills the tree the way FluidLSMBulkLoader::bulk_load_entries does, bottom level first with every level
+     * at capacity. The first level holds its maximum number of runs, deeper levels a single run the loader merged
+     * them into, split into as many files.
+     *
+     * @param num_entries Entries to load
+     * @param stop_after_level_filled Stop at the first level that brings the tree past num_entries
+     */
+    void bulk_load(size_t num_entries, bool stop_after_level_filled = false);
+
+    void write(uint64_t count = 1);
+
+    void empty_read(uint64_t count = 1);
+
+    void non_empty_read(uint64_t count = 1);
+
+    void range_read(uint64_t count = 1);
+
+    /**
+     * @brief Flushes the buffer if it holds any write
+     */
+    void flush();
+
+    const std::vector<std::vector<SimulatedRun>> &levels() const {return this->tree;}
+
+    const SimulationStats &stats() const {return this->statistics;}
+
+    std::vector<double> entries_per_level() const;
+
+    std::vector<double> runs_per_level() const;
+
+    std::vector<size_t> files_per_level() const;
+
+    /**
+     * @brief Bytes written to disk by flushes and compactions per byte written by the user
+     */
+    double write_amplification() const;
+
+    /**
+     * @brief Expected I/O of the tree in its current shape
+     */
+    LSMCostModel cost_model() const;
+
+private:
+    FluidOptions opt;
+    double key_domain;
+    size_t max_levels;
+    DeviceCosts device;
+
+    std::vector<std::vector<SimulatedRun>> tree; //> runs of every level, oldest first
+    uint64_t buffered_entries = 0;
+    SimulationStats statistics;
+
+    // Read costs of the current shape, refreshed whenever the shape changes
+    bool costs_valid = false;
+    double empty_read_cost = 0;
+    double non_empty_read_cost = 0;
+    double range_read_cost = 0;
+
+    void refresh_costs();
+
+    int largest_occupied_level_idx() const;
+
+    /**
+     * @brief Mirrors FluidLSMCompactor::PickCompaction followed by the compaction itself
+     *
+     * @return true if a compaction ran
+     */
+    bool compact_level(size_t level_idx, int largest_level_idx);
+
+    /**
+     * @brief Files written when merging a run of entries out of level_idx, sized as
+     * FluidLSMCompactor::compaction_options would
+     */
+    size_t output_files(double entries, size_t level_idx, bool last_level) const;
+
+    /**
+     * @brief Unique keys left after merging runs. Runs are independent uniform samples of the key domain, so a key is
+     * missing from the merged run only if it is missing from every input.
+     *
+     * @param runs Inputs of the merge
+     * @param key_fraction Share of the key domain the inputs cover
+     */
+    double merged_entries(const std::vector<SimulatedRun> &runs, double key_fraction = 1.0) const;
+};
+
+} /* namespace tmpdb */
+
+#endif /* LSM_SIMULATOR_H_ */
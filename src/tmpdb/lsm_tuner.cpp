@@ -0,0 +1,177 @@
+#include "tmpdb/lsm_tuner.hpp"
+
+using namespace tmpdb;
+
+#define MIN_OPS_PER_ROUND 1000 //> rounds with fewer operations keep the current shape
+
+
+LSMTuner::LSMTuner(FluidLSMCompactor *compactor, int max_size_ratio, double min_improvement, DeviceCosts device)
+    : compactor(compactor),
+    max_size_ratio(std::max(max_size_ratio, 2)),
+    min_improvement(min_improvement),
+    device(device),
+    empty_reads(0),
+    non_empty_reads(0),
+    range_reads(0),
+    writes(0),
+    stopping(false) {}
+
+
+LSMTuner::~LSMTuner()
+{
+    this->stop();
+}
+
+
+void LSMTuner::record_read(bool found)
+{
+    if (found)
+    {
+        this->non_empty_reads++;
+    }
+    else
+    {
+        this->empty_reads++;
+    }
+}
+
+
+void LSMTuner::record_range_read()
+{
+    this->range_reads++;
+}
+
+
+void LSMTuner::record_write()
+{
+    this->writes++;
+}
+
+
+WorkloadMix LSMTuner::observed_workload()
+{
+    double z0 = this->empty_reads.load();
+    double z1 = this->non_empty_reads.load();
+    double q = this->range_reads.load();
+    double w = this->writes.load();
+    double total = z0 + z1 + q + w;
+    if (total == 0)
+    {
+        return {0, 0, 0, 0};
+    }
+
+    return {z0 / total, z1 / total, q / total, w / total};
+}
+
+
+void LSMTuner::decay_counters()
+{
+    this->empty_reads.fetch_sub(this->empty_reads.load() / 2);
+    this->non_empty_reads.fetch_sub(this->non_empty_reads.load() / 2);
+    this->range_reads.fetch_sub(this->range_reads.load() / 2);
+    this->writes.fetch_sub(this->writes.load() / 2);
+}
+
+
+double LSMTuner::evaluate(const FluidOptions &opt, const WorkloadMix &mix, size_t num_entries)
+{
+    return LSMCostModel(opt, num_entries, this->device).cost(mix);
+}
+
+
+FluidOptions LSMTuner::best_options(const FluidOptions &current, const WorkloadMix &mix, size_t num_entries)
+{
+    FluidOptions best = current;
+    best.size_ratio_per_level.clear();
+    best.run_max_per_level.clear();
+    double best_cost = this->evaluate(best, mix, num_entries);
+
+    FluidOptions candidate = best;
+    for (int T = 2; T <= this->max_size_ratio; T++)
+    {
+        candidate.size_ratio = T;
+        for (int K = 1; K < T; K++)
+        {
+            candidate.lower_level_run_max = K;
+            for (int Z = 1; Z < T; Z++)
+            {
+                candidate.largest_level_run_max = Z;
+                double cost = this->evaluate(candidate, mix, num_entries);
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best = candidate;
+                }
+            }
+        }
+    }
+
+    return best;
+}
+
+
+bool LSMTuner::retune()
+{
+    uint64_t total_ops = this->empty_reads + this->non_empty_reads + this->range_reads + this->writes;
+    if ((total_ops < MIN_OPS_PER_ROUND) || this->compactor->migration_in_progress())
+    {
+        return false;
+    }
+
+    FluidOptions current = this->compactor->current_options();
+    size_t num_entries = this->compactor->tree_bytes() / current.entry_size;
+    if (num_entries == 0)
+    {
+        return false;
+    }
+
+    WorkloadMix mix = this->observed_workload();
+    this->decay_counters();
+    spdlog::debug("Observed workload (z0, z1, q, w) : ({:.3f}, {:.3f}, {:.3f}, {:.3f})", mix.z0, mix.z1, mix.q, mix.w);
+
+    FluidOptions target = this->best_options(current, mix, num_entries);
+    double current_cost = this->evaluate(current, mix, num_entries);
+    double target_cost = this->evaluate(target, mix, num_entries);
+    if (target_cost >= (1 - this->min_improvement) * current_cost)
+    {
+        return false;
+    }
+
+    spdlog::debug("Tuning towards (T, K, Z) : ({}, {}, {}), expected cost {:.3f} -> {:.3f}",
+        target.size_ratio, target.lower_level_run_max, target.largest_level_run_max, current_cost, target_cost);
+    this->compactor->begin_migration(target);
+
+    return true;
+}
+
+
+void LSMTuner::start(std::chrono::milliseconds interval)
+{
+    if (this->tuner_thread.joinable()) {return;}
+
+    this->stopping = false;
+    this->tuner_thread = std::thread([this, interval] {
+        std::unique_lock<std::mutex> lock(this->tuner_mutex);
+        while (!this->tuner_cv.wait_for(lock, interval, [this] { return this->stopping; }))
+        {
+            lock.unlock();
+            this->retune();
+            lock.lock();
+        }
+    });
+}
+
+
+void LSMTuner::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->tuner_mutex);
+        this->stopping = true;
+    }
+    this->tuner_cv.notify_all();
+
+    if (this->tuner_thread.joinable())
+    {
+        this->tuner_thread.join();
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef LSM_TUNER_H_
+#define LSM_TUNER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "spdlog/spdlog.h"
+#include "tmpdb/fluid_lsm_compactor.hpp"
+#include "tmpdb/fluid_options.hpp"
+#include "tmpdb/lsm_cost_model.hpp"
+
+namespace tmpdb
+{
+
+/**
+ * @brief Watches the operations issued against a live DB and periodically moves the shape of the tree (T, K, Z)
+ * towards the one with the lowest expected cost for the observed workload.
+ */
+class LSMTuner
+{
+public:
+    /**
+     * @brief Construct a new LSMTuner object
+     *
+     * @param compactor Compactor of the live DB, receives the new shapes
+     * @param max_size_ratio Largest size ratio considered
+     * @param min_improvement Relative cost reduction required before the shape is changed
+     * @param device Device read and write costs weighing the cost model
+     */
+    LSMTuner(FluidLSMCompactor *compactor, int max_size_ratio = 16, double min_improvement = 0.05,
+        DeviceCosts device = DeviceCosts());
+
+    ~LSMTuner();
+
+    /**
+     * @brief Records a point lookup
+     *
+     * @param found Whether the key existed (non-empty read)
+     */
+    void record_read(bool found);
+
+    void record_range_read();
+
+    void record_write();
+
+    /**
+     * @brief Mix of operations recorded so far, older rounds weigh exponentially less
+     */
+    WorkloadMix observed_workload();
+
+    /**
+     * @brief Expected cost per operation of a tree shape under a workload, see LSMCostModel
+     *
+     * @param opt Tree shape
+     * @param mix Workload
+     * @param num_entries Entries in the tree
+     * @return double Expected cost per operation
+     */
+    double evaluate(const FluidOptions &opt, const WorkloadMix &mix, size_t num_entries);
+
+    /**
+     * @brief Searches (T, K, Z) for the shape with the lowest expected cost. Bits per element are kept as is since
+     * filters are built by the table factory configured when the DB was opened.
+     *
+     * @param current Shape the search starts from, every other option is carried over
+     * @param mix Workload
+     * @param num_entries Entries in the tree
+     * @return FluidOptions
+     */
+    FluidOptions best_options(const FluidOptions &current, const WorkloadMix &mix, size_t num_entries);
+
+    /**
+     * @brief Runs one tuning round, migrating the tree to the best shape if it is cheap enough to matter. Rounds are
+     * skipped while a previous migration is still converging.
+     *
+     * @return true if a migration started
+     */
+    bool retune();
+
+    /**
+     * @brief Starts a background thread calling retune every interval
+     *
+     * @param interval
+     */
+    void start(std::chrono::milliseconds interval);
+
+    void stop();
+
+private:
+    FluidLSMCompactor *compactor;
+    int max_size_ratio;
+    double min_improvement;
+    DeviceCosts device;
+
+    std::atomic<uint64_t> empty_reads;
+    std::atomic<uint64_t> non_empty_reads;
+    std::atomic<uint64_t> range_reads;
+    std::atomic<uint64_t> writes;
+
+    std::mutex tuner_mutex;
+    std::condition_variable tuner_cv;
+    bool stopping;
+    std::thread tuner_thread;
+
+    /**
+     * @brief Halves every counter so the observed mix follows the recent workload
+     */
+    void decay_counters();
+};
+
+} /* namespace tmpdb */
+
+#endif /* LSM_TUNER_H_ */
@@ -9,9 +9,12 @@
 #include "rocksdb/db.h"
 #include "rocksdb/table.h"
 #include "rocksdb/filter_policy.h"
+#include "tmpdb/dynamic_monkey_filter_policy.hpp"
 #include "tmpdb/fluid_lsm_compactor.hpp"
 #include "infrastructure/bulk_loader.hpp"
 #include "infrastructure/data_generator.hpp"
+#include "infrastructure/key_file.hpp"
+#include "infrastructure/template_store.hpp"
 
 typedef struct environment
 {
@@ -22,6 +25,8 @@ typedef struct environment
     double T = 2;
     double K = 1;
     double Z = 1;
+    std::vector<double> T_per_level;
+    std::vector<int> K_per_level;
     size_t B = 1 << 20; //> 1 MiB
     size_t E = 1 << 10; //> 1 KiB
     double bits_per_element = 5.0;
@@ -37,8 +42,13 @@ typedef struct environment
     int seed = 0;
     tmpdb::file_size_policy file_size_policy_opt = tmpdb::file_size_policy::INCREASING;
     uint64_t fixed_file_size = std::numeric_limits<uint64_t>::max();
+    bool partial_compaction = false;
+    bool cascade_compaction = false;
 
     bool early_fill_stop = false;
+    bool sst_loader = false;
+
+    std::string template_store;
 
 } environment;
 
@@ -68,6 +78,10 @@ environment parse_args(int argc, char * argv[])
                 % ("lower levels file limit, [default: " + fmt::format("{:.0f}", env.K) + "]"),
             (option("-Z", "--last_level_lim") & number("lim", env.Z))
                 % ("last level file limit, [default: " + fmt::format("{:.0f}", env.Z) + "]"),
+            (option("--per_level_T") & numbers("ratio", env.T_per_level))
+                % "size ratio of each level (first entry is level 1), levels not listed use -T",
+            (option("--per_level_K") & integers("lim", env.K_per_level))
+                % "file limit of each lower level (first entry is level 1), levels not listed use -K",
             (option("-B", "--buffer-size") & integer("size", env.B))
                 % ("buffer size (in bytes), [default: " + to_string(env.B) + "]"),
             (option("-E", "--entry-size") & integer("size", env.E))
@@ -91,11 +105,21 @@ environment parse_args(int argc, char * argv[])
             (option("--max_rocksdb_level") & integer("num", env.max_rocksdb_levels))
                 % ("limits the maximum levels rocksdb has [default: " + to_string(env.max_rocksdb_levels) + "]"),
             (option("--parallelism") & integer("num", env.parallelism))
-                % ("parallelism for writing to db [default: " + to_string(env.parallelism) + "]"),
+                % ("parallelism for writing to db, with --sst_loader also threads generating and writing runs "
+                    "[default: " + to_string(env.parallelism) + "]"),
             (option("--seed") & integer("num", env.seed))
                 % "seed for generating data [default: random from time]",
             (option("--early_fill_stop").set(env.early_fill_stop, true))
-                % "Stops bulk loading early if N is met [default: False]"
+                % "Stops bulk loading early if N is met [default: False]",
+            (option("--sst_loader").set(env.sst_loader, true))
+                % "Ingest runs written once as SST files straight into their level [default: False]",
+            (option("--template_store") & value("dir", env.template_store))
+                % "Clone the DB from a template of the same options and seed if the store has one, else save the "
+                  "built DB as one [default: off]",
+            (option("--partial_compaction").set(env.partial_compaction, true))
+                % "With fixed or buffer files, compact only enough files to fit a level [default: False]",
+            (option("--cascade_compaction").set(env.cascade_compaction, true))
+                % "Merge two levels at once when both would overflow [default: False]"
         )
     );
 
@@ -131,6 +155,18 @@ environment parse_args(int argc, char * argv[])
         spdlog::error("Entry size is less than {} bytes", minimum_entry_size);
     }
 
+    // A level not growing past the previous one would leave the level estimate looking for capacity forever
+    tmpdb::FluidOptions shape;
+    shape.size_ratio = env.T;
+    shape.lower_level_run_max = env.K;
+    shape.largest_level_run_max = env.Z;
+    shape.size_ratio_per_level = env.T_per_level;
+    shape.run_max_per_level = env.K_per_level;
+    if (!shape.shape_valid())
+    {
+        help = true;
+    }
+
     if (help)
     {
         auto fmt = doc_formatting{}.doc_column(42);
@@ -147,6 +183,8 @@ void fill_fluid_opt(environment env, tmpdb::FluidOptions &fluid_opt)
     fluid_opt.size_ratio = env.T;
     fluid_opt.largest_level_run_max = env.Z;
     fluid_opt.lower_level_run_max = env.K;
+    fluid_opt.size_ratio_per_level = env.T_per_level;
+    fluid_opt.run_max_per_level = env.K_per_level;
     fluid_opt.buffer_size = env.B;
     fluid_opt.entry_size = env.E;
     fluid_opt.bits_per_element = env.bits_per_element;
@@ -154,7 +192,7 @@ void fill_fluid_opt(environment env, tmpdb::FluidOptions &fluid_opt)
     if (fluid_opt.bulk_load_opt == tmpdb::bulk_load_type::ENTRIES)
     {
         fluid_opt.num_entries = env.N;
-        fluid_opt.levels = tmpdb::FluidLSMCompactor::estimate_levels(env.N, env.T, env.E, env.B);
+        fluid_opt.levels = tmpdb::FluidLSMCompactor::estimate_levels(env.N, fluid_opt);
     }
     else
     {
@@ -163,21 +201,18 @@ void fill_fluid_opt(environment env, tmpdb::FluidOptions &fluid_opt)
     }
     fluid_opt.file_size_policy_opt = env.file_size_policy_opt;
     fluid_opt.fixed_file_size = env.fixed_file_size;
+    fluid_opt.partial_compaction = env.partial_compaction;
+    fluid_opt.cascade_compaction = env.cascade_compaction;
 }
 
 
 void write_existing_keys(environment & env, FluidLSMBulkLoader * fluid_compactor)
 {
-    std::ofstream key_file;
-    key_file.open(env.db_path + "/existing_keys.data");
-    
     spdlog::info("Writing out {} existing keys", fluid_compactor->keys.size());
-    for (auto key : fluid_compactor->keys)
+    if (!fluid_compactor->keys.merge_into(env.db_path + "/" + KEY_FILE_NAME))
     {
-        key_file << key << std::endl;
+        spdlog::error("Unable to write existing keys");
     }
-
-    key_file.close();
 }
 
 
@@ -201,27 +236,42 @@ void build_db(environment & env)
     rocksdb_opt.target_file_size_base = UINT64_MAX;
 
     fill_fluid_opt(env, fluid_opt);
-    RandomGenerator gen(env.seed);
-    FluidLSMBulkLoader *fluid_compactor = new FluidLSMBulkLoader(gen, fluid_opt, rocksdb_opt, env.early_fill_stop);
-    rocksdb_opt.listeners.emplace_back(fluid_compactor);
 
-    rocksdb::BlockBasedTableOptions table_options;
-    if (env.L > 0)
+    TemplateStore store(env.template_store);
+    std::string template_key = TemplateStore::template_key(fluid_opt, env.seed,
+        fmt::format("sst_loader={} early_fill_stop={} max_rocksdb_levels={}",
+            env.sst_loader, env.early_fill_stop, env.max_rocksdb_levels));
+    if (!env.template_store.empty() && store.contains(template_key))
     {
-        table_options.filter_policy.reset(
-            rocksdb::NewMonkeyFilterPolicy(
-                env.bits_per_element,
-                (int) env.T,
-                env.L + 1));
+        if (rocksdb::Env::Default()->FileExists(env.db_path + "/CURRENT").ok())
+        {
+            spdlog::error("DB already exists at {}, destroy it to clone template {}", env.db_path, template_key);
+            exit(EXIT_FAILURE);
+        }
+        spdlog::info("Cloning DB from template {}", template_key);
+        if (!TemplateStore::clone(rocksdb::Env::Default(), store.template_path(template_key), env.db_path))
+        {
+            exit(EXIT_FAILURE);
+        }
+        spdlog::info("Template : {}", store.template_path(template_key));
+        return;
     }
-    else
+
+    if (env.sst_loader)
     {
-        table_options.filter_policy.reset(
-            rocksdb::NewMonkeyFilterPolicy(
-                env.bits_per_element,
-                (int) env.T,
-                FluidLSMBulkLoader::estimate_levels(env.N, env.T, env.E, env.B) + 1));
+        // Ingested files sink to the bottom of the DB, which has to be the last level of the tree. Opening the DB
+        // with more levels afterwards is fine.
+        rocksdb_opt.num_levels = std::min<int>(std::max<size_t>(fluid_opt.levels, 1), env.max_rocksdb_levels);
     }
+    RandomGenerator gen(env.seed);
+    FluidLSMBulkLoader *fluid_compactor = new FluidLSMBulkLoader(
+        gen, fluid_opt, rocksdb_opt, env.db_path + "/key_spill", env.early_fill_stop, env.sst_loader, env.parallelism);
+    rocksdb_opt.listeners.emplace_back(fluid_compactor);
+
+    rocksdb::BlockBasedTableOptions table_options;
+    // The loader does not track levels, so filters follow the capacities of the fluid_opt.levels levels being built
+    table_options.filter_policy.reset(
+        new tmpdb::DynamicMonkeyFilterPolicy(env.bits_per_element, fluid_compactor));
     table_options.no_block_cache = true;
     rocksdb_opt.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table_options));
 
@@ -253,7 +303,10 @@ void build_db(environment & env)
 
     spdlog::info("Waiting for all compactions to finish before closing");
     // Wait for all compactions to finish before flushing and closing DB
-    while(fluid_compactor->compactions_left_count > 0);
+    while (!fluid_compactor->wait_for_compactions(std::chrono::seconds(30)))
+    {
+        spdlog::debug("Still waiting on {} compactions", fluid_compactor->compactions_left_count);
+    }
 
     if (spdlog::get_level() <= spdlog::level::debug)
     {
@@ -281,6 +334,11 @@ void build_db(environment & env)
 
     db->Close();
     delete db;
+
+    if (!env.template_store.empty() && store.save(env.db_path, template_key))
+    {
+        spdlog::info("Template : {}", store.template_path(template_key));
+    }
 }
 
 
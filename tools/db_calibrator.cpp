@@ -0,0 +1,261 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+
+#include "clipp.h"
+#include "spdlog/spdlog.h"
+
+#include "rocksdb/env.h"
+
+#include "tmpdb/device_options.hpp"
+
+#define CHUNK_SIZE (1 << 20) //> 1 MiB, sequential I/O unit
+#define ALIGNMENT 4096       //> direct I/O buffers, offsets and sizes must be block aligned
+
+typedef struct environment
+{
+    std::string db_path;
+
+    size_t file_size = 1 << 30; //> 1 GiB, large enough to step out of the device cache
+    size_t page_size = 4096;
+    size_t random_reads = 10000;
+    int seed = 42;
+
+    int verbose = 0;
+} environment;
+
+
+environment parse_args(int argc, char * argv[])
+{
+    using namespace clipp;
+    using std::to_string;
+
+    environment env;
+    bool help = false;
+
+    auto general_opt = "general options" % (
+        (option("-v", "--verbose") & integer("level", env.verbose))
+            % ("Logging levels (DEFAULT: INFO, 1: DEBUG, 2: TRACE)"),
+        (option("-h", "--help").set(help, true)) % "prints this message"
+    );
+
+    auto calibration_opt = "calibration options:" % (
+        (value("db_path", env.db_path)) % "path to the DB, the device config is written beside its fluid config",
+        (option("-s", "--file_size") & integer("size", env.file_size))
+            % ("bytes written and read sequentially [default: " + to_string(env.file_size) + "]"),
+        (option("-P", "--page_size") & integer("size", env.page_size))
+            % ("bytes of a random read [default: " + to_string(env.page_size) + "]"),
+        (option("-r", "--random_reads") & integer("num", env.random_reads))
+            % ("random page reads [default: " + to_string(env.random_reads) + "]"),
+        (option("--seed") & integer("num", env.seed))
+            % ("seed for the random read offsets [default: " + to_string(env.seed) + "]")
+    );
+
+    auto cli = (
+        general_opt,
+        calibration_opt
+    );
+
+    if (!parse(argc, argv, cli) || help)
+    {
+        auto fmt = doc_formatting{}.doc_column(42);
+        std::cout << make_man_page(cli, "db_calibrator", fmt);
+        exit(EXIT_FAILURE);
+    }
+
+    return env;
+}
+
+
+/**
+ * @brief Writes the calibration file sequentially with direct I/O, the way flushes and compactions write SSTs
+ *
+ * @return double Throughput in bytes per second, 0 on failure
+ */
+double sequential_write(rocksdb::Env *rocksdb_env, const std::string &file_path, const environment &env, char *buf)
+{
+    rocksdb::EnvOptions env_opt;
+    env_opt.use_direct_writes = true;
+
+    std::unique_ptr<rocksdb::WritableFile> file;
+    rocksdb::Status status = rocksdb_env->NewWritableFile(file_path, &file, env_opt);
+    if (!status.ok())
+    {
+        spdlog::error("Unable to create {}: {}", file_path, status.ToString());
+        return 0;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t written = 0; written < env.file_size; written += CHUNK_SIZE)
+    {
+        status = file->Append(rocksdb::Slice(buf, CHUNK_SIZE));
+        if (!status.ok()) {break;}
+    }
+    if (status.ok()) {status = file->Sync();}
+    if (status.ok()) {status = file->Close();}
+    auto stop = std::chrono::high_resolution_clock::now();
+    if (!status.ok())
+    {
+        spdlog::error("Sequential write failed: {}", status.ToString());
+        return 0;
+    }
+
+    double seconds = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() / 1e6;
+    return env.file_size / seconds;
+}
+
+
+/**
+ * @brief Reads the calibration file front to back with direct I/O, the way compactions read their inputs
+ *
+ * @return double Throughput in bytes per second, 0 on failure
+ */
+double sequential_read(rocksdb::RandomAccessFile *file, const environment &env, char *buf)
+{
+    rocksdb::Slice result;
+    rocksdb::Status status;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint64_t offset = 0; offset < env.file_size; offset += CHUNK_SIZE)
+    {
+        status = file->Read(offset, CHUNK_SIZE, &result, buf);
+        if (!status.ok()) {break;}
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    if (!status.ok())
+    {
+        spdlog::error("Sequential read failed: {}", status.ToString());
+        return 0;
+    }
+
+    double seconds = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() / 1e6;
+    return env.file_size / seconds;
+}
+
+
+/**
+ * @brief Reads pages at uniformly random aligned offsets with direct I/O, the way lookups read data blocks
+ *
+ * @return double Average latency of a page read in microseconds, 0 on failure
+ */
+double random_read(rocksdb::RandomAccessFile *file, const environment &env, char *buf)
+{
+    std::mt19937_64 engine(env.seed);
+    std::uniform_int_distribution<uint64_t> dist(0, (env.file_size / env.page_size) - 1);
+    rocksdb::Slice result;
+    rocksdb::Status status;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t read_idx = 0; read_idx < env.random_reads; read_idx++)
+    {
+        status = file->Read(dist(engine) * env.page_size, env.page_size, &result, buf);
+        if (!status.ok()) {break;}
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    if (!status.ok())
+    {
+        spdlog::error("Random read failed: {}", status.ToString());
+        return 0;
+    }
+
+    double micros = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
+    return micros / env.random_reads;
+}
+
+
+int main(int argc, char * argv[])
+{
+    spdlog::set_pattern("[%T.%e]%^[%l]%$ %v");
+    environment env = parse_args(argc, argv);
+
+    spdlog::info("Welcome to the db_calibrator!");
+    if(env.verbose == 1)
+    {
+        spdlog::info("Log level: DEBUG");
+        spdlog::set_level(spdlog::level::debug);
+    }
+    else if(env.verbose == 2)
+    {
+        spdlog::info("Log level: TRACE");
+        spdlog::set_level(spdlog::level::trace);
+    }
+    else
+    {
+        spdlog::set_level(spdlog::level::info);
+    }
+
+    if ((env.page_size == 0) || (env.page_size % ALIGNMENT != 0) || (CHUNK_SIZE % env.page_size != 0)
+        || (env.file_size < CHUNK_SIZE) || (env.random_reads == 0))
+    {
+        spdlog::error("Page size must be a multiple of {} dividing {}, file size at least {} and random reads positive",
+            ALIGNMENT, CHUNK_SIZE, CHUNK_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    env.file_size -= env.file_size % CHUNK_SIZE;
+
+    rocksdb::Env *rocksdb_env = rocksdb::Env::Default();
+    rocksdb_env->CreateDirIfMissing(env.db_path);
+    std::string file_path = env.db_path + "/calibration.tmp";
+
+    char *buf = nullptr;
+    if (posix_memalign(reinterpret_cast<void **>(&buf), ALIGNMENT, CHUNK_SIZE) != 0)
+    {
+        spdlog::error("Unable to allocate an aligned buffer");
+        exit(EXIT_FAILURE);
+    }
+    std::mt19937 engine(env.seed);
+    std::uniform_int_distribution<int> byte_dist(0, 255);
+    for (size_t idx = 0; idx < CHUNK_SIZE; idx++)
+    {
+        buf[idx] = static_cast<char>(byte_dist(engine));
+    }
+
+    tmpdb::DeviceOptions device_opt;
+    device_opt.page_size = env.page_size;
+
+    spdlog::info("Writing {} MiB sequentially", env.file_size >> 20);
+    device_opt.sequential_write_bytes_per_sec = sequential_write(rocksdb_env, file_path, env, buf);
+
+    rocksdb::EnvOptions env_opt;
+    env_opt.use_direct_reads = true;
+    std::unique_ptr<rocksdb::RandomAccessFile> file;
+    rocksdb::Status status = rocksdb_env->NewRandomAccessFile(file_path, &file, env_opt);
+    if ((device_opt.sequential_write_bytes_per_sec > 0) && status.ok())
+    {
+        spdlog::info("Reading {} MiB sequentially", env.file_size >> 20);
+        device_opt.sequential_read_bytes_per_sec = sequential_read(file.get(), env, buf);
+        spdlog::info("Reading {} random pages", env.random_reads);
+        device_opt.random_read_micros = random_read(file.get(), env, buf);
+        file.reset();
+    }
+    else if (!status.ok())
+    {
+        spdlog::error("Unable to open {}: {}", file_path, status.ToString());
+    }
+    rocksdb_env->DeleteFile(file_path);
+    free(buf);
+
+    if ((device_opt.sequential_write_bytes_per_sec == 0) || (device_opt.sequential_read_bytes_per_sec == 0)
+        || (device_opt.random_read_micros == 0))
+    {
+        spdlog::error("Calibration incomplete, no device config written");
+        exit(EXIT_FAILURE);
+    }
+
+    tmpdb::DeviceCosts costs = device_opt.costs();
+    spdlog::info("random read : {:.1f} us/page, sequential read : {:.1f} MiB/s, sequential write : {:.1f} MiB/s",
+        device_opt.random_read_micros,
+        device_opt.sequential_read_bytes_per_sec / (1 << 20),
+        device_opt.sequential_write_bytes_per_sec / (1 << 20));
+    spdlog::info("Per page costs relative to a random read (read, sequential read, write) : ({:.3f}, {:.3f}, {:.3f})",
+        costs.read_cost, costs.sequential_read_cost, costs.write_cost);
+
+    if (!device_opt.write_config(env.db_path + "/device_config.json"))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    return 0;
+}
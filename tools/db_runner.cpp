@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <chrono>
 #include <ctime>
 #include <iostream>
@@ -16,10 +17,17 @@
 #include "rocksdb/iostats_context.h"
 #include "rocksdb/perf_context.h"
 
+#include "tmpdb/device_options.hpp"
+#include "tmpdb/dynamic_monkey_filter_policy.hpp"
 #include "tmpdb/fluid_lsm_compactor.hpp"
+#include "tmpdb/lsm_cost_model.hpp"
+#include "tmpdb/lsm_tuner.hpp"
 #include "infrastructure/data_generator.hpp"
+#include "infrastructure/key_file.hpp"
+#include "infrastructure/template_store.hpp"
 
 #define PAGESIZE 4096
+#define ANALYSIS_TOLERANCE 0.25 //> relative deviation from the model flagged by --analyze
 
 typedef struct environment
 {
@@ -37,16 +45,34 @@ typedef struct environment
     int compaction_readahead_size = 64;
     int seed = 42;
     int max_open_files = 512;
+    int tune_interval = 0;
+    std::vector<int> migrate_shape;
+    bool hit_rate_filters = false;
+    bool analyze = false;
 
     std::string write_out_path;
     bool write_out = false;
 
+    std::string template_path;
+
     int verbose = 0;
 
     bool prime_db = false;
 } environment;
 
 
+typedef struct phase_measure
+{
+size_t ops = 0;
+int duration = 0;                   //> ms
+uint64_t block_reads = 0;
+uint64_t filter_negatives = 0;      //> probes a filter ruled out
+uint64_t filter_positives = 0;
+uint64_t filter_true_positives = 0;
+uint64_t io_bytes = 0;              //> written by flushes, read and written by compactions
+} phase_measure;
+
+
 environment parse_args(int argc, char * argv[])
 {
     using namespace clipp;
@@ -74,16 +100,26 @@ environment parse_args(int argc, char * argv[])
         (option("-o", "--output").set(env.write_out) & value("file", env.write_out_path))
             % ("optional write out all recorded times [default: off]"),
         (option("-p", "--prime").set(env.prime_db) & value("num", env.prime_reads))
-            % ("optional warm up the database with reads [default: off]")
+            % ("optional warm up the database with reads [default: off]"),
+        (option("--template") & value("dir", env.template_path))
+            % "replace the DB with a clone of a template saved by db_builder before running [default: off]"
     );
 
     auto minor_opt = "minor options:" % (
         (option("--parallelism") & integer("threads", env.parallelism))
-            % ("Threads allocated for RocksDB [default: " + to_string(env.parallelism) + "]"),
+            % ("Threads allocated for RocksDB and compaction workers [default: " + to_string(env.parallelism) + "]"),
         (option("--compact-readahead") & integer("size", env.compaction_readahead_size))
             % ("Use 2048 for HDD, 64 for flash [default: " + to_string(env.compaction_readahead_size) + "]"),
         (option("--rand_seed") & integer("seed", env.seed))
-            % ("Random seed for experiment reproducability [default: " + to_string(env.seed) + "]")
+            % ("Random seed for experiment reproducability [default: " + to_string(env.seed) + "]"),
+        (option("--tune_interval") & integer("ms", env.tune_interval))
+            % "Retune T, K and Z to the observed workload every interval, 0 disables it [default: 0]",
+        (option("--hit_rate_filters").set(env.hit_rate_filters, true))
+            % "Size filters of new files by the measured hit rate per level, not only level sizes [default: off]",
+        (option("--migrate") & integers("T K Z", env.migrate_shape))
+            % "Migrate the tree online to a new size ratio and run limits, e.g. --migrate 10 9 9 [default: off]",
+        (option("--analyze").set(env.analyze, true))
+            % "Compare the measured I/O of every operation type with the cost model [default: off]"
     );
 
     auto cli = (
@@ -112,7 +148,13 @@ rocksdb::Status open_db(environment env,
     spdlog::debug("Opening database");
     // rocksdb::Options rocksdb_opt;
     // rocksdb_opt.statistics = rocksdb::CreateDBStatistics();
-    fluid_opt = new tmpdb::FluidOptions(env.db_path + "/fluid_config.json");
+    fluid_opt = new tmpdb::FluidOptions();
+    std::string fluid_config_path = env.db_path + "/fluid_config.json";
+    if (!fluid_opt->read_config(fluid_config_path) && std::ifstream(fluid_config_path).good())
+    {
+        // Without a config the defaults are used, a config with an invalid shape would stop levels from growing
+        return rocksdb::Status::InvalidArgument("Invalid tree shape in " + fluid_config_path);
+    }
 
     rocksdb_opt.create_if_missing = false;
     rocksdb_opt.error_if_exists = false;
@@ -135,37 +177,22 @@ rocksdb::Status open_db(environment env,
     // Note that level 0 in RocksDB is traditionally level 1 in an LSM model. The write buffer is what we normally would
     // label as level 0. Here we want level 1 to contain T sst files before trigger a compaction. Need to test whether
     // this mattesrs given our custom compaction listener
-    rocksdb_opt.level0_file_num_compaction_trigger = fluid_opt->lower_level_run_max + 1;
+    rocksdb_opt.level0_file_num_compaction_trigger = fluid_opt->level_run_max(0, false) + 1;
 
     // Number of files in level 0 to slow down writes. Since we're prioritizing compactions we will wait for those to
     // finish up first by slowing down the write speed
-    rocksdb_opt.level0_slowdown_writes_trigger = 8 * (fluid_opt->lower_level_run_max + 1);
-    rocksdb_opt.level0_stop_writes_trigger = 10 * (fluid_opt->lower_level_run_max + 1);
+    rocksdb_opt.level0_slowdown_writes_trigger = 8 * (fluid_opt->level_run_max(0, false) + 1);
+    rocksdb_opt.level0_stop_writes_trigger = 10 * (fluid_opt->level_run_max(0, false) + 1);
 
-    fluid_compactor = new tmpdb::FluidLSMCompactor(*fluid_opt, rocksdb_opt);
+    fluid_compactor = new tmpdb::FluidLSMCompactor(*fluid_opt, rocksdb_opt, env.parallelism);
     rocksdb_opt.listeners.emplace_back(fluid_compactor);
 
     rocksdb::BlockBasedTableOptions table_options;
-    if (fluid_opt->levels > 0)
-    {
-        table_options.filter_policy.reset(
-            rocksdb::NewMonkeyFilterPolicy(
-                fluid_opt->bits_per_element,
-                fluid_opt->size_ratio,
-                fluid_opt->levels + 1));
-    }
-    else
-    {
-        table_options.filter_policy.reset(
-            rocksdb::NewMonkeyFilterPolicy(
-                fluid_opt->bits_per_element,
-                fluid_opt->size_ratio, 
-                tmpdb::FluidLSMCompactor::estimate_levels(
-                    fluid_opt->num_entries,
-                    fluid_opt->size_ratio,
-                    fluid_opt->entry_size,
-                    fluid_opt->buffer_size) + 1));
-    }
+    table_options.filter_policy.reset(
+        new tmpdb::DynamicMonkeyFilterPolicy(
+            fluid_opt->bits_per_element,
+            fluid_compactor,
+            env.hit_rate_filters ? rocksdb_opt.statistics : nullptr));
     table_options.no_block_cache = true;
     rocksdb_opt.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table_options));
 
@@ -178,62 +205,70 @@ rocksdb::Status open_db(environment env,
         return status;
     }
 
+    // Filters of the very first flush are already sized from the level view
+    fluid_compactor->refresh_level_view(db);
+
     return status;
 }
 
 
-std::vector<std::string> get_all_valid_keys(environment env)
+bool open_existing_keys(environment env, KeyFile & existing_keys)
 {
-    // TODO: In reality we should be saving the list of all keys while building the DB to speed up testing. No need to
-    // go through and retrieve all keys manually
-    spdlog::debug("Grabbing existing keys");
-    std::vector<std::string> existing_keys;
-    std::string key;
-    std::ifstream key_file(env.db_path + "/existing_keys.data");
-
-    if (key_file.is_open())
+    spdlog::debug("Mapping existing keys");
+    std::string key_path = env.db_path + "/" + KEY_FILE_NAME;
+    std::ifstream text_file(env.db_path + "/existing_keys.data");
+    if ((access(key_path.c_str(), F_OK) != 0) && text_file.is_open())
     {
-        while (std::getline(key_file, key))
+        // DBs built before the binary key file hold one key per line, converted once here
+        spdlog::info("Converting existing_keys.data into {}", KEY_FILE_NAME);
+        std::vector<std::string> keys;
+        std::string key;
+        while (std::getline(text_file, key))
+        {
+            keys.push_back(key);
+        }
+        if (!KeyFile::write(key_path, keys))
         {
-            existing_keys.push_back(key);
+            return false;
         }
     }
 
-    std::sort(existing_keys.begin(), existing_keys.end());
-
-    return existing_keys;
+    return existing_keys.open(key_path);
 }
 
 
 void append_valid_keys(environment env, std::vector<std::string> & new_keys)
 {
     spdlog::debug("Adding new keys to existing key file");
-    std::ofstream key_file;
-
-    key_file.open(env.db_path + "/existing_keys.data", std::ios::app);
-
-    for (auto key : new_keys)
+    if (!KeyFile::append(env.db_path + "/" + KEY_FILE_NAME, new_keys))
     {
-        key_file << key << std::endl;
+        spdlog::error("Unable to add new keys to the existing key file");
     }
-
-    key_file.close();
 }
 
 
-int run_random_non_empty_reads(environment env, std::vector<std::string> existing_keys, rocksdb::DB * db)
+int run_random_non_empty_reads(environment env,
+                               const KeyFile & existing_keys,
+                               rocksdb::DB * db,
+                               tmpdb::LSMTuner * tuner)
 {
     spdlog::info("{} Non-Empty Reads", env.non_empty_reads);
     rocksdb::Status status;
+    if (existing_keys.size() == 0)
+    {
+        spdlog::warn("No existing keys to read");
+        return 0;
+    }
 
     std::string value;
     std::mt19937 engine;
-    std::uniform_int_distribution<int> dist(0, existing_keys.size() - 1);
+    std::uniform_int_distribution<uint64_t> dist(0, existing_keys.size() - 1);
 
     auto non_empty_read_start = std::chrono::high_resolution_clock::now();
     for (size_t read_count = 0; read_count < env.non_empty_reads; read_count++)
     {
-        status = db->Get(rocksdb::ReadOptions(), existing_keys[dist(engine)], &value);
+        status = db->Get(rocksdb::ReadOptions(), existing_keys.key(dist(engine)), &value);
+        if (tuner) {tuner->record_read(status.ok());}
     }
     auto non_empty_read_end = std::chrono::high_resolution_clock::now();
     auto non_empty_read_duration = std::chrono::duration_cast<std::chrono::milliseconds>(non_empty_read_end - non_empty_read_start);
@@ -243,7 +278,7 @@ int run_random_non_empty_reads(environment env, std::vector<std::string> existin
 }
 
 
-int run_random_empty_reads(environment env, rocksdb::DB * db)
+int run_random_empty_reads(environment env, rocksdb::DB * db, tmpdb::LSMTuner * tuner)
 {
     spdlog::info("{} Empty Reads", env.empty_reads);
     rocksdb::Status status;
@@ -256,6 +291,7 @@ int run_random_empty_reads(environment env, rocksdb::DB * db)
     for (size_t read_count = 0; read_count < env.empty_reads; read_count++)
     {
         status = db->Get(rocksdb::ReadOptions(), std::to_string(dist(engine)), &value);
+        if (tuner) {tuner->record_read(status.ok());}
     }
     auto empty_read_end = std::chrono::high_resolution_clock::now();
     auto empty_read_duration = std::chrono::duration_cast<std::chrono::milliseconds>(empty_read_end - empty_read_start);
@@ -266,23 +302,30 @@ int run_random_empty_reads(environment env, rocksdb::DB * db)
 
 
 int run_range_reads(environment env,
-                    std::vector<std::string> existing_keys,
+                    const KeyFile & existing_keys,
                     tmpdb::FluidOptions * fluid_opt,
-                    rocksdb::DB * db)
+                    rocksdb::DB * db,
+                    tmpdb::LSMTuner * tuner)
 {
     spdlog::info("{} Range Queries", env.range_reads);
     rocksdb::ReadOptions read_opt;
     rocksdb::Status status;
-    std::string lower_key, upper_key;
-    int key_idx, valid_keys = 0;
+    rocksdb::Slice lower_key, upper_key;
+    uint64_t key_idx;
+    int valid_keys = 0;
 
     // We use existing keys to 100% enforce all range queries to be short range queries
     int key_hop = (PAGESIZE / fluid_opt->entry_size);
     spdlog::debug("Keys per range query : {}", key_hop);
+    if (existing_keys.size() <= static_cast<uint64_t>(key_hop))
+    {
+        spdlog::warn("Too few existing keys for range reads of {} keys", key_hop);
+        return 0;
+    }
 
     std::string value;
     std::mt19937 engine;
-    std::uniform_int_distribution<int> dist(0, existing_keys.size() - 1 - key_hop);
+    std::uniform_int_distribution<uint64_t> dist(0, existing_keys.size() - 1 - key_hop);
 
     read_opt.fill_cache = false;
     read_opt.total_order_seek = true;
@@ -291,17 +334,18 @@ int run_range_reads(environment env,
     for (size_t range_count = 0; range_count < env.range_reads; range_count++)
     {
         key_idx = dist(engine);
-        lower_key = existing_keys[key_idx];
-        upper_key = existing_keys[key_idx + key_hop];
-        read_opt.iterate_upper_bound = new rocksdb::Slice(upper_key);
+        lower_key = existing_keys.key(key_idx);
+        upper_key = existing_keys.key(key_idx + key_hop);
+        read_opt.iterate_upper_bound = &upper_key;
         rocksdb::Iterator * it = db->NewIterator(read_opt);
-        for (it->Seek(rocksdb::Slice(lower_key)); it->Valid(); it->Next())
+        for (it->Seek(lower_key); it->Valid(); it->Next())
         {
             // status = db->Get(read_opt, it->key(), &value);
             value = it->value().ToString();
             valid_keys++;
         }
         delete it;
+        if (tuner) {tuner->record_range_read();}
     }
     auto range_read_end = std::chrono::high_resolution_clock::now();
     auto range_read_duration = std::chrono::duration_cast<std::chrono::milliseconds>(range_read_end - range_read_start);
@@ -316,7 +360,8 @@ int run_range_reads(environment env,
 int run_random_inserts(environment env,
                        tmpdb::FluidOptions * fluid_opt,
                        tmpdb::FluidLSMCompactor * fluid_compactor,
-                       rocksdb::DB * db)
+                       rocksdb::DB * db,
+                       tmpdb::LSMTuner * tuner)
 {
     spdlog::info("{} Write Queries", env.writes);
     rocksdb::WriteOptions write_opt;
@@ -338,6 +383,8 @@ int run_random_inserts(environment env,
         std::pair<std::string, std::string> entry = data_gen.generate_kv_pair(fluid_opt->entry_size);
         new_keys.push_back(entry.first);
         status = db->Put(write_opt, entry.first, entry.second);
+        fluid_compactor->throttle_write(fluid_opt->entry_size);
+        if (tuner) {tuner->record_write();}
         if (!status.ok())
         {
             spdlog::warn("Unable to put key {}", write_idx);
@@ -363,12 +410,12 @@ int run_random_inserts(environment env,
     db->Flush(flush_opt);
 
     spdlog::debug("Waiting for all remaining background compactions to finish before after writes");
-    while(fluid_compactor->compactions_left_count > 0);
+    fluid_compactor->wait_for_compactions();
 
     spdlog::debug("Checking final state of the tree and if it requires any compactions...");
     while(fluid_compactor->requires_compaction(db))
     {
-        while(fluid_compactor->compactions_left_count > 0);
+        fluid_compactor->wait_for_compactions();
     }
 
     auto end_write_time = std::chrono::high_resolution_clock::now();
@@ -422,6 +469,233 @@ void print_db_status(rocksdb::DB * db)
 }
 
 
+/**
+ * @brief Entries and filter bytes of every level, summed over the table properties of its files
+ */
+void level_table_properties(rocksdb::DB * db,
+                            std::vector<uint64_t> & entries_per_level,
+                            std::vector<uint64_t> & filter_bytes_per_level)
+{
+    rocksdb::ColumnFamilyMetaData cf_meta;
+    db->GetColumnFamilyMetaData(&cf_meta);
+    std::map<std::string, size_t> file_levels;
+    for (size_t level_idx = 0; level_idx < cf_meta.levels.size(); level_idx++)
+    {
+        for (auto & file : cf_meta.levels[level_idx].files)
+        {
+            file_levels[file.name] = level_idx;
+        }
+    }
+
+    rocksdb::TablePropertiesCollection table_props;
+    db->GetPropertiesOfAllTables(&table_props);
+    entries_per_level.assign(cf_meta.levels.size(), 0);
+    filter_bytes_per_level.assign(cf_meta.levels.size(), 0);
+    for (auto & props : table_props)
+    {
+        std::string name = props.first.substr(props.first.find_last_of('/'));
+        if (file_levels.find(name) == file_levels.end()) { continue; }
+        entries_per_level[file_levels[name]] += props.second->num_entries;
+        filter_bytes_per_level[file_levels[name]] += props.second->filter_size;
+    }
+}
+
+
+void print_filter_report(rocksdb::DB * db,
+                         std::map<std::string, uint64_t> & stats,
+                         const std::map<uint32_t, rocksdb::PerfContextByLevel> & level_perf)
+{
+    // Bloom probes answered negative (useful) or positive, and positives the key was actually found for
+    auto fpr = [](double negatives, double positives, double true_positives) {
+        double false_positives = positives - true_positives;
+        return (negatives + false_positives > 0) ? false_positives / (negatives + false_positives) : 0.0;
+    };
+
+    std::vector<uint64_t> entries_per_level, filter_bytes_per_level;
+    level_table_properties(db, entries_per_level, filter_bytes_per_level);
+
+    uint64_t total_filter_bytes = 0;
+    for (size_t level_idx = 0; level_idx < entries_per_level.size(); level_idx++)
+    {
+        if (entries_per_level[level_idx] == 0) { continue; }
+        double bits_per_key = 8.0 * filter_bytes_per_level[level_idx] / entries_per_level[level_idx];
+        total_filter_bytes += filter_bytes_per_level[level_idx];
+
+        double measured_fpr = 0;
+        auto perf = level_perf.find(level_idx);
+        if (perf != level_perf.end())
+        {
+            measured_fpr = fpr(perf->second.bloom_filter_useful, perf->second.bloom_filter_full_positive,
+                perf->second.bloom_filter_full_true_positive);
+        }
+        spdlog::info("filter L{} (entries, KB, bits per key, expected fpr, measured fpr) : "
+            "({}, {}, {:.2f}, {:.5f}, {:.5f})",
+            level_idx + 1,
+            entries_per_level[level_idx],
+            filter_bytes_per_level[level_idx] >> 10,
+            bits_per_key,
+            std::exp(-bits_per_key * std::pow(std::log(2), 2)),
+            measured_fpr);
+    }
+
+    double measured_fpr = fpr(stats["rocksdb.bloom.filter.useful"], stats["rocksdb.bloom.filter.full.positive"],
+        stats["rocksdb.bloom.filter.full.true.positive"]);
+    spdlog::info("filter memory : {} KB, measured fpr : {:.5f}", total_filter_bytes >> 10, measured_fpr);
+}
+
+
+bool load_device_options(environment & env, tmpdb::DeviceOptions & device_opt)
+{
+    // Written by db_calibrator, plain I/O counts are used without it
+    std::string device_config_path = env.db_path + "/device_config.json";
+    if (!std::ifstream(device_config_path).good()) { return false; }
+
+    return device_opt.read_config(device_config_path);
+}
+
+
+/**
+ * @brief Running totals of the counters an operation phase is measured by
+ */
+phase_measure measure_counters(rocksdb::Statistics * statistics)
+{
+    phase_measure counters;
+    counters.block_reads = rocksdb::get_perf_context()->block_read_count;
+    counters.filter_negatives = statistics->getTickerCount(rocksdb::BLOOM_FILTER_USEFUL);
+    counters.filter_positives = statistics->getTickerCount(rocksdb::BLOOM_FILTER_FULL_POSITIVE);
+    counters.filter_true_positives = statistics->getTickerCount(rocksdb::BLOOM_FILTER_FULL_TRUE_POSITIVE);
+    counters.io_bytes = statistics->getTickerCount(rocksdb::FLUSH_WRITE_BYTES)
+        + statistics->getTickerCount(rocksdb::COMPACT_READ_BYTES)
+        + statistics->getTickerCount(rocksdb::COMPACT_WRITE_BYTES);
+
+    return counters;
+}
+
+
+phase_measure measure_phase(const phase_measure & before, rocksdb::Statistics * statistics, size_t ops, int duration)
+{
+    phase_measure phase = measure_counters(statistics);
+    phase.ops = ops;
+    phase.duration = duration;
+    phase.block_reads -= before.block_reads;
+    phase.filter_negatives -= before.filter_negatives;
+    phase.filter_positives -= before.filter_positives;
+    phase.filter_true_positives -= before.filter_true_positives;
+    phase.io_bytes -= before.io_bytes;
+
+    return phase;
+}
+
+
+double deviation(double measured, double expected)
+{
+    return (expected > 0) ? (measured / expected) - 1 : 0;
+}
+
+
+/**
+ * @brief Sets the measured I/O of every operation phase beside the cost model, once for the shape the tree actually
+ * has and once for the shape it is configured to have. The first tells how far the model is from the engine, the
+ * second how far the tree has drifted from its intended shape. Reads are measured in block reads, writes in pages
+ * flushed and compacted.
+ *
+ * @param phases Measures of the empty read, non-empty read, range read and write phases, in that order
+ */
+void print_model_report(environment & env,
+                        rocksdb::DB * db,
+                        tmpdb::FluidLSMCompactor * fluid_compactor,
+                        const std::vector<phase_measure> & phases)
+{
+    std::vector<uint64_t> entries_per_level, filter_bytes_per_level;
+    level_table_properties(db, entries_per_level, filter_bytes_per_level);
+    rocksdb::ColumnFamilyMetaData cf_meta;
+    db->GetColumnFamilyMetaData(&cf_meta);
+
+    // Levels past the first are a single sorted run in RocksDB, however many files they are split into
+    std::vector<double> observed_entries, observed_runs;
+    double num_entries = 0;
+    for (size_t level_idx = 0; level_idx < entries_per_level.size(); level_idx++)
+    {
+        size_t files = cf_meta.levels[level_idx].files.size();
+        observed_entries.push_back(entries_per_level[level_idx]);
+        observed_runs.push_back((level_idx == 0) ? files : std::min<size_t>(files, 1));
+        num_entries += entries_per_level[level_idx];
+    }
+    while (!observed_entries.empty() && (observed_entries.back() == 0))
+    {
+        observed_entries.pop_back();
+        observed_runs.pop_back();
+    }
+    if (num_entries == 0)
+    {
+        spdlog::warn("Tree is empty, nothing to analyze");
+        return;
+    }
+
+    tmpdb::FluidOptions opt = fluid_compactor->current_options();
+    tmpdb::LSMCostModel observed(opt, observed_entries, observed_runs);
+    tmpdb::LSMCostModel configured(opt, static_cast<size_t>(num_entries));
+    double observed_io[] = {observed.empty_read_cost(), observed.non_empty_read_cost(),
+        observed.range_read_cost(), observed.write_cost()};
+    double configured_io[] = {configured.empty_read_cost(), configured.non_empty_read_cost(),
+        configured.range_read_cost(), configured.write_cost()};
+
+    // Calibrated costs are in units of a random page read, which turns them into time
+    tmpdb::DeviceOptions device_opt;
+    bool calibrated = load_device_options(env, device_opt) && (device_opt.random_read_micros > 0);
+    tmpdb::LSMCostModel timed(opt, observed_entries, observed_runs, device_opt.costs());
+    double timed_costs[] = {timed.empty_read_cost(), timed.non_empty_read_cost(),
+        timed.range_read_cost(), timed.write_cost()};
+
+    const char * op_names[] = {"z0", "z1", "q", "w"};
+    for (size_t op_idx = 0; op_idx < 4; op_idx++)
+    {
+        const phase_measure & phase = phases[op_idx];
+        if (phase.ops == 0) { continue; }
+
+        double io = (op_idx == 3) ? static_cast<double>(phase.io_bytes) / PAGESIZE : phase.block_reads;
+        double measured = io / phase.ops;
+        double shape_deviation = deviation(measured, configured_io[op_idx]);
+        spdlog::info("analyze {} I/O per op (measured, model, configured shape) : ({:.4f}, {:.4f} [{:+.1f}%], "
+            "{:.4f} [{:+.1f}%])",
+            op_names[op_idx],
+            measured,
+            observed_io[op_idx],
+            100 * deviation(measured, observed_io[op_idx]),
+            configured_io[op_idx],
+            100 * shape_deviation);
+        if (std::abs(shape_deviation) > ANALYSIS_TOLERANCE)
+        {
+            spdlog::warn("analyze {} deviates {:+.1f}% from the configured shape", op_names[op_idx],
+                100 * shape_deviation);
+        }
+
+        if (calibrated)
+        {
+            double measured_micros = 1000.0 * phase.duration / phase.ops;
+            double model_micros = timed_costs[op_idx] * device_opt.random_read_micros;
+            spdlog::info("analyze {} us per op (measured, model) : ({:.2f}, {:.2f} [{:+.1f}%])",
+                op_names[op_idx],
+                measured_micros,
+                model_micros,
+                100 * deviation(measured_micros, model_micros));
+        }
+    }
+
+    // Every false positive of an empty read costs one block read in the model
+    const phase_measure & empty_reads = phases[0];
+    if (empty_reads.ops > 0)
+    {
+        double false_positives = empty_reads.filter_positives - empty_reads.filter_true_positives;
+        double probes = empty_reads.filter_negatives + false_positives;
+        spdlog::info("analyze z0 filter (probes per op, false positives per op, model) : ({:.3f}, {:.4f}, {:.4f})",
+            probes / empty_reads.ops,
+            false_positives / empty_reads.ops,
+            observed.empty_read_cost());
+    }
+}
+
+
 int main(int argc, char * argv[])
 {
     spdlog::set_pattern("[%T.%e]%^[%l]%$ %v");
@@ -443,6 +717,29 @@ int main(int argc, char * argv[])
         spdlog::set_level(spdlog::level::info);
     }
 
+    if (!env.template_path.empty())
+    {
+        // Runs change the tree, hence every run starts over from the template instead of the last run's DB
+        std::vector<std::string> children;
+        rocksdb::Env::Default()->GetChildren(env.db_path, &children);
+        size_t num_files = std::count_if(children.begin(), children.end(), [](const std::string &name) {
+            return (name != ".") && (name != "..");
+        });
+        spdlog::info("Destroying DB at {} ({} files) to clone template {}", env.db_path, num_files, env.template_path);
+        rocksdb::Status destroy_status = rocksdb::DestroyDB(env.db_path, rocksdb::Options());
+        if (!destroy_status.ok())
+        {
+            spdlog::error("Unable to destroy DB at {}: {}", env.db_path, destroy_status.ToString());
+            exit(EXIT_FAILURE);
+        }
+        // Key files and configs of the previous run are no RocksDB files, left over they would mix with the clone
+        TemplateStore::remove_dir(rocksdb::Env::Default(), env.db_path);
+        if (!TemplateStore::clone(rocksdb::Env::Default(), env.template_path, env.db_path))
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
+
     rocksdb::DB * db = nullptr;
     tmpdb::FluidOptions * fluid_opt = nullptr;
     tmpdb::FluidLSMCompactor * fluid_compactor = nullptr;
@@ -450,6 +747,11 @@ int main(int argc, char * argv[])
     rocksdb::Options rocksdb_opt;
     rocksdb_opt.statistics = rocksdb::CreateDBStatistics();
     rocksdb::Status status = open_db(env, fluid_opt, fluid_compactor, rocksdb_opt, db);
+    if (!status.ok())
+    {
+        spdlog::error("Unable to open DB: {}", status.ToString());
+        exit(EXIT_FAILURE);
+    }
     rocksdb::SetPerfLevel(rocksdb::PerfLevel::kEnableTimeExceptForMutex);
 
     if (env.prime_db)
@@ -457,35 +759,95 @@ int main(int argc, char * argv[])
         prime_database(env, db);
     }
 
+    if (env.migrate_shape.size() == 3)
+    {
+        tmpdb::FluidOptions target = fluid_compactor->current_options();
+        target.size_ratio = env.migrate_shape[0];
+        target.lower_level_run_max = env.migrate_shape[1];
+        target.largest_level_run_max = env.migrate_shape[2];
+        target.size_ratio_per_level.clear();
+        target.run_max_per_level.clear();
+        fluid_compactor->refresh_level_view(db);
+        fluid_compactor->begin_migration(target);
+    }
+    else if (!env.migrate_shape.empty())
+    {
+        spdlog::warn("--migrate expects T K Z, ignoring it");
+    }
+
+    tmpdb::LSMTuner * tuner = nullptr;
+    if (env.tune_interval > 0)
+    {
+        tmpdb::DeviceOptions device_opt;
+        load_device_options(env, device_opt);
+        tuner = new tmpdb::LSMTuner(fluid_compactor, 16, 0.05, device_opt.costs());
+        tuner->start(std::chrono::milliseconds(env.tune_interval));
+    }
+
     int empty_read_duration = 0, read_duration = 0, range_duration = 0, write_duration = 0;
-    std::vector<std::string> existing_keys;
-    
-    if ((env.non_empty_reads > 0) || (env.range_reads > 0))
+    KeyFile existing_keys;
+    if (((env.non_empty_reads > 0) || (env.range_reads > 0)) && !open_existing_keys(env, existing_keys))
     {
-        existing_keys = get_all_valid_keys(env);
+        spdlog::error("Non-empty and range reads need the keys written by db_builder");
+        delete db;
+        exit(EXIT_FAILURE);
     }
 
     rocksdb_opt.statistics->Reset();
     rocksdb::get_iostats_context()->Reset();
     rocksdb::get_perf_context()->Reset();
+    // Bloom filter counters per level, reads run on this thread
+    rocksdb::get_perf_context()->EnablePerLevelPerfContext();
+    rocksdb::Statistics * statistics = rocksdb_opt.statistics.get();
+    std::vector<phase_measure> phases(4);
+    phase_measure counters = measure_counters(statistics);
     if (env.empty_reads > 0)
     {
-        empty_read_duration = run_random_empty_reads(env, db); 
+        empty_read_duration = run_random_empty_reads(env, db, tuner); 
+        phases[0] = measure_phase(counters, statistics, env.empty_reads, empty_read_duration);
+        counters = measure_counters(statistics);
     }
 
     if (env.non_empty_reads > 0)
     {
-        read_duration = run_random_non_empty_reads(env, existing_keys, db);
+        read_duration = run_random_non_empty_reads(env, existing_keys, db, tuner);
+        phases[1] = measure_phase(counters, statistics, env.non_empty_reads, read_duration);
+        counters = measure_counters(statistics);
     }
 
     if (env.range_reads > 0)
     {
-        range_duration = run_range_reads(env, existing_keys, fluid_opt, db);
+        range_duration = run_range_reads(env, existing_keys, fluid_opt, db, tuner);
+        phases[2] = measure_phase(counters, statistics, env.range_reads, range_duration);
+        counters = measure_counters(statistics);
+    }
+
+    // Only the read phases count towards the filter report
+    std::map<uint32_t, rocksdb::PerfContextByLevel> level_perf;
+    if (rocksdb::get_perf_context()->level_to_perf_context)
+    {
+        level_perf = *rocksdb::get_perf_context()->level_to_perf_context;
     }
+    rocksdb::get_perf_context()->DisablePerLevelPerfContext();
 
     if (env.writes > 0)
     {
-        write_duration = run_random_inserts(env, fluid_opt, fluid_compactor, db);
+        write_duration = run_random_inserts(env, fluid_opt, fluid_compactor, db, tuner);
+        phases[3] = measure_phase(counters, statistics, env.writes, write_duration);
+    }
+
+    if (tuner)
+    {
+        tuner->stop();
+        delete tuner;
+    }
+
+    if ((env.tune_interval > 0) || (env.migrate_shape.size() == 3))
+    {
+        // Keep the new shape for the next time the DB is opened, levels that have not converged yet simply follow it
+        // from then on
+        fluid_compactor->wait_for_compactions();
+        fluid_compactor->current_options().write_config(env.db_path + "/fluid_config.json");
     }
 
     if (spdlog::get_level() <= spdlog::level::debug)
@@ -514,6 +876,7 @@ int main(int argc, char * argv[])
         stats["rocksdb.compact.write.bytes"],
         stats["rocksdb.flush.write.bytes"]);
     spdlog::info("(block_read_count) : ({})", rocksdb::get_perf_context()->block_read_count);
+    print_filter_report(db, stats, level_perf);
     spdlog::info("(z0, z1, q, w) : ({}, {}, {}, {})", empty_read_duration, read_duration, range_duration, write_duration);
 
     rocksdb::ColumnFamilyMetaData cf_meta;
@@ -527,6 +890,21 @@ int main(int argc, char * argv[])
     run_per_level = run_per_level.substr(0, run_per_level.size() - 2) + "]";
     spdlog::info("runs_per_level : {}", run_per_level);
 
+    // Expected I/Os per operation for the final shape of the tree, comparable to the measured block reads
+    fluid_compactor->refresh_level_view(db);
+    tmpdb::LSMCostModel cost_model(
+        fluid_compactor->current_options(), fluid_compactor->tree_bytes() / fluid_opt->entry_size);
+    spdlog::info("model (z0, z1, q, w) : ({:.4f}, {:.4f}, {:.4f}, {:.4f})",
+        cost_model.empty_read_cost(),
+        cost_model.non_empty_read_cost(),
+        cost_model.range_read_cost(),
+        cost_model.write_cost());
+
+    if (env.analyze)
+    {
+        print_model_report(env, db, fluid_compactor, phases);
+    }
+
     db->Close();
     delete db;
 
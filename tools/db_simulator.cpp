@@ -0,0 +1,271 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "clipp.h"
+#include "spdlog/spdlog.h"
+
+#include "tmpdb/device_options.hpp"
+#include "tmpdb/fluid_options.hpp"
+#include "tmpdb/lsm_simulator.hpp"
+
+typedef struct environment
+{
+    std::string config_path;
+
+    // Shape overrides, 0 keeps the value of the config
+    int T = 0;
+    int K = 0;
+    int Z = 0;
+
+    size_t N = 0; //> 0 bulk loads the num_entries of the config
+    bool early_fill_stop = false;
+
+    // Operations, interleaved one buffer worth of writes at a time, see replay_mixed
+    size_t empty_reads = 0;
+    size_t non_empty_reads = 0;
+    size_t range_reads = 0;
+    size_t writes = 0;
+    std::string trace_path;
+
+    size_t key_domain = 0;
+    int max_levels = 16;
+    std::string device_config_path;
+
+    int verbose = 0;
+} environment;
+
+
+environment parse_args(int argc, char * argv[])
+{
+    using namespace clipp;
+    using std::to_string;
+
+    environment env;
+    bool help = false;
+
+    auto general_opt = "general options" % (
+        (option("-v", "--verbose") & integer("level", env.verbose))
+            % ("Logging levels (DEFAULT: INFO, 1: DEBUG, 2: TRACE)"),
+        (option("-h", "--help").set(help, true)) % "prints this message"
+    );
+
+    auto tree_opt = "tree options:" % (
+        (value("config", env.config_path)) % "fluid config of the tree, e.g. written by db_builder or db_tuner",
+        (option("-T", "--size_ratio") & integer("ratio", env.T)) % "overrides the size ratio of the config",
+        (option("-K", "--lower_level_size_ratio") & integer("runs", env.K)) % "overrides the runs per level",
+        (option("-Z", "--largest_level_size_ratio") & integer("runs", env.Z))
+            % "overrides the runs at the last level",
+        (option("-N", "--entries") & integer("num", env.N))
+            % "entries bulk loaded before replaying operations [default: num_entries of the config]",
+        (option("--early_fill_stop").set(env.early_fill_stop, true))
+            % "stop bulk loading once N entries are reached [default: off]",
+        (option("--key_domain") & integer("num", env.key_domain))
+            % "distinct keys writes are drawn from, merges drop overwritten entries [default: 0, every write is new]",
+        (option("--max_levels") & integer("num", env.max_levels))
+            % ("levels available to the tree [default: " + to_string(env.max_levels) + "]"),
+        (option("--device_config") & value("file", env.device_config_path))
+            % "device config measured by db_calibrator weighing the read I/O [default: I/O counts]"
+    );
+
+    auto workload_opt = "workload options:" % (
+        (option("-e", "--empty_reads") & integer("num", env.empty_reads))
+            % ("empty queries, [default: " + to_string(env.empty_reads) + "]"),
+        (option("-r", "--non_empty_reads") & integer("num", env.non_empty_reads))
+            % ("non-empty queries, [default: " + to_string(env.non_empty_reads) + "]"),
+        (option("-q", "--range_reads") & integer("num", env.range_reads))
+            % ("range reads, [default: " + to_string(env.range_reads) + "]"),
+        (option("-w", "--writes") & integer("num", env.writes))
+            % ("writes, [default: " + to_string(env.writes) + "]"),
+        (option("--trace") & value("file", env.trace_path))
+            % "replays a recorded stream after the counts above, one \"<e|r|q|w> <count>\" per line"
+    );
+
+    auto cli = (
+        general_opt,
+        tree_opt,
+        workload_opt
+    );
+
+    if (!parse(argc, argv, cli) || help)
+    {
+        auto fmt = doc_formatting{}.doc_column(42);
+        std::cout << make_man_page(cli, "db_simulator", fmt);
+        exit(EXIT_FAILURE);
+    }
+
+    return env;
+}
+
+
+bool replay(tmpdb::LSMSimulator &sim, char op, uint64_t count)
+{
+    switch (op)
+    {
+        case 'e': sim.empty_read(count); break;
+        case 'r': sim.non_empty_read(count); break;
+        case 'q': sim.range_read(count); break;
+        case 'w': sim.write(count); break;
+        default: return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief Interleaves the synthetic operations in steps of one buffer worth of writes, every read type spread over the
+ * steps in proportion, so reads see the tree as the writes reshape it
+ */
+void replay_mixed(tmpdb::LSMSimulator &sim, const tmpdb::FluidOptions &opt, const environment &env)
+{
+    const char ops[] = {'e', 'r', 'q', 'w'};
+    const uint64_t counts[] = {env.empty_reads, env.non_empty_reads, env.range_reads, env.writes};
+
+    uint64_t writes_per_step = std::max<uint64_t>(opt.buffer_size / opt.entry_size, 1);
+    uint64_t steps = std::max<uint64_t>((env.writes + writes_per_step - 1) / writes_per_step, 1);
+    for (uint64_t step = 0; step < steps; step++)
+    {
+        for (size_t op_idx = 0; op_idx < 4; op_idx++)
+        {
+            uint64_t done = counts[op_idx] * step / steps;
+            replay(sim, ops[op_idx], counts[op_idx] * (step + 1) / steps - done);
+        }
+    }
+}
+
+
+bool replay_trace(tmpdb::LSMSimulator &sim, const std::string &trace_path)
+{
+    std::ifstream trace(trace_path);
+    if (!trace.is_open())
+    {
+        spdlog::error("Unable to read trace: {}", trace_path);
+        return false;
+    }
+
+    std::string line;
+    for (size_t line_num = 1; std::getline(trace, line); line_num++)
+    {
+        if (line.empty() || line[0] == '#') {continue;}
+
+        std::istringstream fields(line);
+        char op;
+        uint64_t count;
+        if (!(fields >> op >> count) || !replay(sim, op, count))
+        {
+            spdlog::error("Malformed trace line {}: {}", line_num, line);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+void print_tree(const tmpdb::LSMSimulator &sim, const tmpdb::FluidOptions &opt)
+{
+    std::vector<double> entries = sim.entries_per_level();
+    std::vector<double> runs = sim.runs_per_level();
+    std::vector<size_t> files = sim.files_per_level();
+    tmpdb::LSMCostModel model = sim.cost_model();
+    for (size_t level_idx = 0; level_idx < entries.size(); level_idx++)
+    {
+        spdlog::info("L{} : {} runs, {} files, {:.0f} entries ({:.1f}% of capacity), fpr {:.4f}",
+            level_idx + 1,
+            runs[level_idx],
+            files[level_idx],
+            entries[level_idx],
+            100.0 * entries[level_idx] * opt.entry_size / opt.level_capacity(level_idx),
+            model.false_positive_rate(level_idx));
+    }
+}
+
+
+int main(int argc, char * argv[])
+{
+    spdlog::set_pattern("[%T.%e]%^[%l]%$ %v");
+    environment env = parse_args(argc, argv);
+
+    spdlog::info("Welcome to the db_simulator!");
+    if(env.verbose == 1)
+    {
+        spdlog::info("Log level: DEBUG");
+        spdlog::set_level(spdlog::level::debug);
+    }
+    else if(env.verbose == 2)
+    {
+        spdlog::info("Log level: TRACE");
+        spdlog::set_level(spdlog::level::trace);
+    }
+    else
+    {
+        spdlog::set_level(spdlog::level::info);
+    }
+
+    tmpdb::FluidOptions opt;
+    if (!opt.read_config(env.config_path))
+    {
+        exit(EXIT_FAILURE);
+    }
+    if (env.T > 0) {opt.size_ratio = env.T;}
+    if (env.K > 0) {opt.lower_level_run_max = env.K;}
+    if (env.Z > 0) {opt.largest_level_run_max = env.Z;}
+    if (!opt.shape_valid())
+    {
+        exit(EXIT_FAILURE);
+    }
+    size_t N = (env.N > 0) ? env.N : opt.num_entries;
+
+    tmpdb::DeviceCosts device;
+    if (!env.device_config_path.empty())
+    {
+        tmpdb::DeviceOptions device_opt;
+        if (!device_opt.read_config(env.device_config_path))
+        {
+            exit(EXIT_FAILURE);
+        }
+        device = device_opt.costs();
+    }
+
+    spdlog::info("(T, K, Z, B, E) : ({}, {}, {}, {}, {})",
+        opt.size_ratio, opt.lower_level_run_max, opt.largest_level_run_max, opt.buffer_size, opt.entry_size);
+    tmpdb::LSMSimulator sim(opt, env.key_domain, env.max_levels, device);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    sim.bulk_load(N, env.early_fill_stop);
+    spdlog::info("Bulk loaded tree");
+    print_tree(sim, opt);
+
+    replay_mixed(sim, opt, env);
+    if (!env.trace_path.empty() && !replay_trace(sim, env.trace_path))
+    {
+        exit(EXIT_FAILURE);
+    }
+    sim.flush();
+    auto stop = std::chrono::high_resolution_clock::now();
+
+    const tmpdb::SimulationStats &stats = sim.stats();
+    spdlog::info("Final tree");
+    print_tree(sim, opt);
+
+    spdlog::info("Simulated {} operations in {} ms",
+        stats.empty_reads + stats.non_empty_reads + stats.range_reads + stats.writes,
+        std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count());
+    spdlog::info("flushes : {}, compactions : {}, write amplification : {:.2f}",
+        stats.flushes, stats.compactions, sim.write_amplification());
+
+    double page_size = device.page_size;
+    double write_io = (stats.bytes_flushed + stats.bytes_compacted_out) / page_size * device.write_cost
+        + stats.bytes_compacted_in / page_size * device.sequential_read_cost;
+    auto per_op = [](double io, uint64_t ops) {return (ops > 0) ? io / ops : 0.0;};
+    spdlog::info("I/O per op (z0, z1, q, w) : ({:.3f}, {:.3f}, {:.3f}, {:.3f})",
+        per_op(stats.empty_read_io, stats.empty_reads),
+        per_op(stats.non_empty_read_io, stats.non_empty_reads),
+        per_op(stats.range_read_io, stats.range_reads),
+        per_op(write_io, stats.writes));
+    spdlog::info("Total I/O : {:.0f}", stats.empty_read_io + stats.non_empty_read_io + stats.range_read_io + write_io);
+
+    return 0;
+}
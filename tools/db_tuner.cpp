@@ -0,0 +1,291 @@
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include "clipp.h"
+#include "spdlog/spdlog.h"
+
+#include "tmpdb/device_options.hpp"
+#include "tmpdb/fluid_options.hpp"
+#include "tmpdb/lsm_cost_model.hpp"
+
+#define MIN_BUFFER_SIZE (1 << 20) //> 1 MiB
+#define BPE_STEP 0.5
+#define LAMBDA_SEARCH_ITERS 100
+
+typedef struct environment
+{
+    std::string output_path = "fluid_config.json";
+
+    // Expected workload
+    double z0 = 0.25;
+    double z1 = 0.25;
+    double q = 0.25;
+    double w = 0.25;
+    double rho = 0.0;
+
+    // Tree and memory
+    size_t N = 1e6;
+    size_t E = 1 << 10; //> 1 KiB
+    size_t memory = 0; //> bytes, 0 picks a 1 MiB buffer plus 10 bits per entry
+    int max_size_ratio = 32;
+    double read_cost = 1.0;
+    double write_cost = 1.0;
+    std::string device_config_path;
+
+    int verbose = 0;
+} environment;
+
+
+environment parse_args(int argc, char * argv[])
+{
+    using namespace clipp;
+    using std::to_string;
+
+    environment env;
+    bool help = false;
+
+    auto general_opt = "general options" % (
+        (option("-v", "--verbose") & integer("level", env.verbose))
+            % ("Logging levels (DEFAULT: INFO, 1: DEBUG, 2: TRACE)"),
+        (option("-h", "--help").set(help, true)) % "prints this message"
+    );
+
+    auto workload_opt = "workload options:" % (
+        (option("--z0") & number("frac", env.z0))
+            % ("fraction of empty reads [default: " + fmt::format("{:.2f}", env.z0) + "]"),
+        (option("--z1") & number("frac", env.z1))
+            % ("fraction of non-empty reads [default: " + fmt::format("{:.2f}", env.z1) + "]"),
+        (option("--q") & number("frac", env.q))
+            % ("fraction of range reads [default: " + fmt::format("{:.2f}", env.q) + "]"),
+        (option("--w") & number("frac", env.w))
+            % ("fraction of writes [default: " + fmt::format("{:.2f}", env.w) + "]"),
+        (option("--rho") & number("radius", env.rho))
+            % ("uncertainty radius (KL divergence) around the workload, 0 tunes for the workload as is [default: "
+                + fmt::format("{:.2f}", env.rho) + "]")
+    );
+
+    auto tree_opt = "tree options:" % (
+        (option("-N", "--entries") & integer("num", env.N))
+            % ("total entries [default: " + to_string(env.N) + "]"),
+        (option("-E", "--entry-size") & integer("size", env.E))
+            % ("entry size (bytes) [default: " + to_string(env.E) + "]"),
+        (option("-M", "--memory") & integer("size", env.memory))
+            % "memory (bytes) shared by the buffer and bloom filters [default: 1 MiB + 10 bits per entry]",
+        (option("--max_size_ratio") & integer("ratio", env.max_size_ratio))
+            % ("largest size ratio considered [default: " + to_string(env.max_size_ratio) + "]"),
+        (option("--read_cost") & number("cost", env.read_cost))
+            % ("relative cost of a page read [default: " + fmt::format("{:.1f}", env.read_cost) + "]"),
+        (option("--write_cost") & number("cost", env.write_cost))
+            % ("relative cost of a page write [default: " + fmt::format("{:.1f}", env.write_cost) + "]"),
+        (option("--device_config") & value("file", env.device_config_path))
+            % "device config measured by db_calibrator, replaces the read and write costs",
+        (option("-o", "--output") & value("file", env.output_path))
+            % ("path of the written config [default: " + env.output_path + "]")
+    );
+
+    auto cli = (
+        general_opt,
+        workload_opt,
+        tree_opt
+    );
+
+    if (!parse(argc, argv, cli) || help)
+    {
+        auto fmt = doc_formatting{}.doc_column(42);
+        std::cout << make_man_page(cli, "db_tuner", fmt);
+        exit(EXIT_FAILURE);
+    }
+
+    return env;
+}
+
+
+/**
+ * @brief Worst case cost over every workload within KL divergence rho of mix. Solved through the dual
+ * min_{lambda > 0} lambda * rho + lambda * log(sum_i w_i * exp(c_i / lambda)), which is convex in lambda.
+ *
+ * @param model Cost model of a candidate tuning
+ * @param mix Expected workload
+ * @param rho Uncertainty radius
+ * @return double
+ */
+double robust_cost(const tmpdb::LSMCostModel &model, const tmpdb::WorkloadMix &mix, double rho)
+{
+    double weights[] = {mix.z0, mix.z1, mix.q, mix.w};
+    double costs[] = {
+        model.empty_read_cost(), model.non_empty_read_cost(), model.range_read_cost(), model.write_cost()};
+
+    double nominal = 0, max_cost = 0;
+    for (size_t idx = 0; idx < 4; idx++)
+    {
+        nominal += weights[idx] * costs[idx];
+        if (weights[idx] > 0) {max_cost = std::max(max_cost, costs[idx]);}
+    }
+    if (rho <= 0) {return nominal;}
+
+    // Log-sum-exp shifted by the largest cost for stability
+    auto dual = [&](double lambda) {
+        double sum = 0;
+        for (size_t idx = 0; idx < 4; idx++)
+        {
+            if (weights[idx] == 0) {continue;}
+            sum += weights[idx] * std::exp((costs[idx] - max_cost) / lambda);
+        }
+        return (lambda * rho) + max_cost + (lambda * std::log(sum));
+    };
+
+    // Golden section search over log(lambda)
+    const double ratio = (std::sqrt(5) - 1) / 2;
+    double lo = std::log(1e-6), hi = std::log(1e6);
+    double x1 = hi - ratio * (hi - lo), x2 = lo + ratio * (hi - lo);
+    double f1 = dual(std::exp(x1)), f2 = dual(std::exp(x2));
+    for (size_t iter = 0; iter < LAMBDA_SEARCH_ITERS; iter++)
+    {
+        if (f1 < f2)
+        {
+            hi = x2; x2 = x1; f2 = f1;
+            x1 = hi - ratio * (hi - lo);
+            f1 = dual(std::exp(x1));
+        }
+        else
+        {
+            lo = x1; x1 = x2; f1 = f2;
+            x2 = lo + ratio * (hi - lo);
+            f2 = dual(std::exp(x2));
+        }
+    }
+
+    // The adversary can at most put all its weight on the most expensive operation
+    return std::max(nominal, std::min(std::min(f1, f2), max_cost));
+}
+
+
+tmpdb::FluidOptions tune(environment & env, const tmpdb::WorkloadMix &mix)
+{
+    tmpdb::DeviceCosts device;
+    device.read_cost = env.read_cost;
+    device.write_cost = env.write_cost;
+    if (!env.device_config_path.empty())
+    {
+        tmpdb::DeviceOptions device_opt;
+        if (!device_opt.read_config(env.device_config_path))
+        {
+            exit(EXIT_FAILURE);
+        }
+        device = device_opt.costs();
+        spdlog::info("Device costs (read, sequential read, write) : ({:.3f}, {:.3f}, {:.3f})",
+            device.read_cost, device.sequential_read_cost, device.write_cost);
+    }
+
+    double memory_bits = 8.0 * env.memory;
+    double max_bpe = (memory_bits - 8.0 * MIN_BUFFER_SIZE) / env.N;
+    if (max_bpe < 0)
+    {
+        spdlog::error("Memory budget does not fit the minimum buffer of {} bytes", MIN_BUFFER_SIZE);
+        exit(EXIT_FAILURE);
+    }
+
+    tmpdb::FluidOptions best, candidate;
+    candidate.entry_size = env.E;
+    candidate.num_entries = env.N;
+    candidate.bulk_load_opt = tmpdb::bulk_load_type::ENTRIES;
+    double best_cost = std::numeric_limits<double>::max();
+
+    for (double bpe = 0; bpe <= max_bpe; bpe += BPE_STEP)
+    {
+        // Memory not spent on filters goes to the buffer
+        candidate.bits_per_element = bpe;
+        candidate.buffer_size = static_cast<size_t>((memory_bits - bpe * env.N) / 8);
+        for (int T = 2; T <= env.max_size_ratio; T++)
+        {
+            candidate.size_ratio = T;
+            for (int K = 1; K < T; K++)
+            {
+                candidate.lower_level_run_max = K;
+                for (int Z = 1; Z < T; Z++)
+                {
+                    candidate.largest_level_run_max = Z;
+                    double cost = robust_cost(tmpdb::LSMCostModel(candidate, env.N, device), mix, env.rho);
+                    if (cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best = candidate;
+                    }
+                }
+            }
+        }
+    }
+
+    tmpdb::LSMCostModel best_model(best, env.N, device);
+    best.levels = best_model.levels();
+    spdlog::info("Worst case cost : {:.4f}, expected cost : {:.4f}", best_cost, best_model.cost(mix));
+    spdlog::info("(z0, z1, q, w) costs : ({:.4f}, {:.4f}, {:.4f}, {:.4f})",
+        best_model.empty_read_cost(),
+        best_model.non_empty_read_cost(),
+        best_model.range_read_cost(),
+        best_model.write_cost());
+
+    return best;
+}
+
+
+int main(int argc, char * argv[])
+{
+    spdlog::set_pattern("[%T.%e]%^[%l]%$ %v");
+    environment env = parse_args(argc, argv);
+
+    spdlog::info("Welcome to the db_tuner!");
+    if(env.verbose == 1)
+    {
+        spdlog::info("Log level: DEBUG");
+        spdlog::set_level(spdlog::level::debug);
+    }
+    else if(env.verbose == 2)
+    {
+        spdlog::info("Log level: TRACE");
+        spdlog::set_level(spdlog::level::trace);
+    }
+    else
+    {
+        spdlog::set_level(spdlog::level::info);
+    }
+
+    double total = env.z0 + env.z1 + env.q + env.w;
+    if ((total <= 0) || (env.z0 < 0) || (env.z1 < 0) || (env.q < 0) || (env.w < 0) || (env.N == 0))
+    {
+        spdlog::error("Workload fractions must be non-negative with a positive sum, and N positive");
+        exit(EXIT_FAILURE);
+    }
+    tmpdb::WorkloadMix mix = {env.z0 / total, env.z1 / total, env.q / total, env.w / total};
+    if (env.memory == 0)
+    {
+        env.memory = MIN_BUFFER_SIZE + static_cast<size_t>(10.0 * env.N / 8);
+    }
+
+    spdlog::info("Tuning for (z0, z1, q, w) : ({:.3f}, {:.3f}, {:.3f}, {:.3f}), rho : {:.2f}",
+        mix.z0, mix.z1, mix.q, mix.w, env.rho);
+    tmpdb::FluidOptions fluid_opt = tune(env, mix);
+
+    spdlog::info("(T, K, Z, B, h) : ({}, {}, {}, {}, {:.1f})",
+        fluid_opt.size_ratio,
+        fluid_opt.lower_level_run_max,
+        fluid_opt.largest_level_run_max,
+        fluid_opt.buffer_size,
+        fluid_opt.bits_per_element);
+    spdlog::info("db_builder flags : -T {} -K {} -Z {} -B {} -E {} -b {:.1f} -N {}",
+        fluid_opt.size_ratio,
+        fluid_opt.lower_level_run_max,
+        fluid_opt.largest_level_run_max,
+        fluid_opt.buffer_size,
+        fluid_opt.entry_size,
+        fluid_opt.bits_per_element,
+        fluid_opt.num_entries);
+
+    if (!fluid_opt.write_config(env.output_path))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    return 0;
+}
@@ -1,25 +1,46 @@
 #include "bulk_loader.hpp"
 
 
+/**
+ * @brief Runs task(0) .. task(num_tasks - 1) on up to num_threads threads, the calling thread included
+ */
+static void parallel_for(size_t num_tasks, size_t num_threads, const std::function<void(size_t)> &task)
+{
+    std::atomic<size_t> next_task(0);
+    auto worker = [&]()
+    {
+        for (size_t task_idx = next_task++; task_idx < num_tasks; task_idx = next_task++)
+        {
+            task(task_idx);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t thread_idx = 1; thread_idx < std::min(num_threads, num_tasks); thread_idx++)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : workers)
+    {
+        thread.join();
+    }
+}
+
+
 rocksdb::Status FluidLSMBulkLoader::bulk_load_entries(rocksdb::DB *db, size_t num_entries)
 {
     spdlog::info("Bulk loading DB with {} entries", num_entries);
     rocksdb::Status status;
 
     size_t E = this->fluid_opt.entry_size;
-    size_t B = this->fluid_opt.buffer_size;
-    double T = this->fluid_opt.size_ratio;
-    size_t estimated_levels = tmpdb::FluidLSMCompactor::estimate_levels(num_entries, T, E, B);
+    size_t estimated_levels = tmpdb::FluidLSMCompactor::estimate_levels(num_entries, this->fluid_opt);
     spdlog::debug("Estimated levels: {}", estimated_levels);
 
-    size_t entries_in_buffer = (B / E);
-    spdlog::debug("Number of entries that can fit in the buffer: {}", entries_in_buffer);
-
     std::vector<size_t> capacity_per_level(estimated_levels);
-    capacity_per_level[0] = (entries_in_buffer) * (T - 1);
-    for (size_t level_idx = 1; level_idx < estimated_levels; level_idx++)
+    for (size_t level_idx = 0; level_idx < estimated_levels; level_idx++)
     {
-        capacity_per_level[level_idx] = capacity_per_level[level_idx - 1] * T;
+        capacity_per_level[level_idx] = this->fluid_opt.level_capacity(level_idx) / E;
     }
 
     if (spdlog::get_level() <= spdlog::level::debug)
@@ -44,14 +65,10 @@ rocksdb::Status FluidLSMBulkLoader::bulk_load_levels(rocksdb::DB *db, size_t num
     spdlog::info("Bulk loading DB with {} levels", num_levels);
     rocksdb::Status status;
 
-    size_t entries_in_buffer = (this->fluid_opt.buffer_size / this->fluid_opt.entry_size);
-    spdlog::debug("Number of entries that can fit in the buffer: {}", entries_in_buffer);
-
     std::vector<size_t> capacity_per_level(num_levels);
-    capacity_per_level[0] = entries_in_buffer * (this->fluid_opt.size_ratio - 1);
-    for (size_t level_idx = 1; level_idx < num_levels; level_idx++)
+    for (size_t level_idx = 0; level_idx < num_levels; level_idx++)
     {
-        capacity_per_level[level_idx] = capacity_per_level[level_idx - 1] * this->fluid_opt.size_ratio;
+        capacity_per_level[level_idx] = this->fluid_opt.level_capacity(level_idx) / this->fluid_opt.entry_size;
     }
 
     if (spdlog::get_level() <= spdlog::level::debug)
@@ -81,6 +98,28 @@ rocksdb::Status FluidLSMBulkLoader::bulk_load(
     size_t level_idx;
     size_t num_runs;
     size_t num_entries_loaded = 0;
+    std::vector<SstRun> sst_runs;
+
+    if (this->sst_loader)
+    {
+        // SST files are written outside of any level, hence the allocation the filter policy would give each level is
+        // computed up front from the capacities being loaded
+        std::vector<double> entries(num_levels), runs(num_levels);
+        double total_entries = 0;
+        for (size_t level_idx = 0; level_idx < num_levels; level_idx++)
+        {
+            entries[level_idx] = capacity_per_level[level_idx];
+            runs[level_idx] = this->fluid_opt.level_run_max(level_idx, level_idx == num_levels - 1);
+            total_entries += entries[level_idx];
+        }
+        std::vector<double> fprs = tmpdb::LSMCostModel::monkey_false_positive_rates(
+            entries, runs, this->fluid_opt.bits_per_element * total_entries);
+        this->bits_per_level.resize(num_levels);
+        for (size_t level_idx = 0; level_idx < num_levels; level_idx++)
+        {
+            this->bits_per_level[level_idx] = tmpdb::LSMCostModel::bits_per_key(fprs[level_idx]);
+        }
+    }
 
     // Fill up levels starting from the BOTTOM
     for (size_t level = num_levels; level > 0; level--)
@@ -89,16 +128,18 @@ rocksdb::Status FluidLSMBulkLoader::bulk_load(
         if (capacity_per_level[level_idx] == 0) { continue; }
         spdlog::debug("Bulk loading level {} with {} entries.", level, capacity_per_level[level_idx]);
 
-        if (level == num_levels) //> Last level has Z max runs
+        // Last level has Z max runs, every other level inbetween has K_i max runs
+        num_runs = this->fluid_opt.level_run_max(level_idx, level == num_levels);
+
+        if (this->sst_loader)
         {
-            num_runs = this->fluid_opt.largest_level_run_max;
+            this->plan_sst_level(level_idx, capacity_per_level[level_idx], num_runs, sst_runs);
         }
-        else //> Every other level inbetween has K max runs
+        else
         {
-            num_runs = this->fluid_opt.lower_level_run_max;
+            status = this->bulk_load_single_level(db, level_idx, capacity_per_level[level_idx], num_runs);
+            if (!status.ok()) { return status; }
         }
-
-        status = this->bulk_load_single_level(db, level_idx, capacity_per_level[level_idx], num_runs);
         num_entries_loaded += capacity_per_level[level_idx];
         if (this->stop_after_level_filled && num_entries_loaded > max_entries)
         {
@@ -107,6 +148,11 @@ rocksdb::Status FluidLSMBulkLoader::bulk_load(
         }
     }
 
+    if (this->sst_loader)
+    {
+        status = this->sst_load(db, sst_runs);
+    }
+
     return status;
 }
 
@@ -128,6 +174,7 @@ rocksdb::Status FluidLSMBulkLoader::bulk_load_single_level(
             (entries_per_run * this->fluid_opt.entry_size) / static_cast<double>(1 << 20));
 
         status = this->bulk_load_single_run(db, entries_per_run);
+        if (!status.ok()) { return status; }
     }
 
     // Force all runs in this level to be mapped to their respective level
@@ -193,7 +240,12 @@ rocksdb::Status FluidLSMBulkLoader::bulk_load_single_run(rocksdb::DB *db, size_t
             std::pair<std::string, std::string> key_value =
                 this->data_gen.generate_kv_pair(this->fluid_opt.entry_size);
             batch.Put(key_value.first, key_value.second);
-            this->keys.push_back(key_value.first);
+            if (!this->keys.add(key_value.first))
+            {
+                // The key file would silently miss keys, stop before writing anything it does not cover
+                spdlog::error("Unable to spill keys after {} entries", entry_num + i);
+                return rocksdb::Status::IOError("Unable to spill keys");
+            }
         }
         status = db->Write(write_opt, &batch);
         if (!status.ok())
@@ -211,6 +263,261 @@ rocksdb::Status FluidLSMBulkLoader::bulk_load_single_run(rocksdb::DB *db, size_t
 }
 
 
+void FluidLSMBulkLoader::plan_sst_level(
+    size_t level_idx,
+    size_t capacity_per_level,
+    size_t num_runs,
+    std::vector<SstRun> &runs)
+{
+    size_t entries_per_run = capacity_per_level / num_runs;
+    if (entries_per_run == 0) { return; }
+
+    SstRun run;
+    run.level_idx = level_idx;
+    run.run_idx = 0;
+    if ((level_idx == 0) && (this->fluid_opt.file_size_policy_opt != tmpdb::file_size_policy::FIXED))
+    {
+        run.num_entries = entries_per_run;
+        run.file_size = UINT64_MAX;
+        for (run.run_idx = 0; run.run_idx < num_runs; run.run_idx++)
+        {
+            runs.push_back(run);
+        }
+        return;
+    }
+
+    run.num_entries = entries_per_run * num_runs;
+    if (this->fluid_opt.file_size_policy_opt == tmpdb::file_size_policy::INCREASING)
+    {
+        run.file_size = 1.05 * entries_per_run * this->fluid_opt.entry_size;
+    }
+    else if (this->fluid_opt.file_size_policy_opt == tmpdb::file_size_policy::BUFFER)
+    {
+        run.file_size = this->fluid_opt.buffer_size;
+    }
+    else
+    {
+        run.file_size = this->fluid_opt.fixed_file_size;
+    }
+    runs.push_back(run);
+}
+
+
+rocksdb::Status FluidLSMBulkLoader::sst_load(rocksdb::DB *db, std::vector<SstRun> &runs)
+{
+    rocksdb::Status status;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Every chunk of every run is an independent task, as is every file once its run is split
+    std::vector<std::pair<size_t, size_t>> tasks;
+    for (size_t run_pos = 0; run_pos < runs.size(); run_pos++)
+    {
+        size_t num_chunks = (runs[run_pos].num_entries + SST_CHUNK_ENTRIES - 1) / SST_CHUNK_ENTRIES;
+        runs[run_pos].segment_paths.resize(num_chunks);
+        for (size_t chunk_idx = 0; chunk_idx < num_chunks; chunk_idx++)
+        {
+            tasks.push_back(std::make_pair(run_pos, chunk_idx));
+        }
+    }
+    spdlog::debug("Generating {} runs in {} chunks on {} threads", runs.size(), tasks.size(), this->num_threads);
+    parallel_for(tasks.size(), this->num_threads, [&](size_t task_idx)
+    {
+        this->generate_sst_chunk(runs[tasks[task_idx].first], tasks[task_idx].second);
+    });
+
+    std::vector<std::vector<std::unique_ptr<KeyFile>>> run_segments(runs.size());
+    std::vector<std::vector<const KeyFile *>> run_files(runs.size());
+    tasks.clear();
+    for (size_t run_pos = 0; run_pos < runs.size(); run_pos++)
+    {
+        SstRun &run = runs[run_pos];
+        for (auto &segment_path : run.segment_paths)
+        {
+            run_segments[run_pos].emplace_back(new KeyFile());
+            if (segment_path.empty() || !run_segments[run_pos].back()->open(segment_path, false))
+            {
+                spdlog::error("Unable to spill keys of level {}", run.level_idx + 1);
+                return rocksdb::Status::IOError("Unable to spill keys");
+            }
+            run_files[run_pos].push_back(run_segments[run_pos].back().get());
+        }
+        this->split_sst_run(run, run_files[run_pos]);
+        for (size_t file_idx = 0; file_idx < run.file_names.size(); file_idx++)
+        {
+            tasks.push_back(std::make_pair(run_pos, file_idx));
+        }
+    }
+    std::vector<rocksdb::Status> file_status(tasks.size());
+    parallel_for(tasks.size(), this->num_threads, [&](size_t task_idx)
+    {
+        size_t run_pos = tasks[task_idx].first;
+        file_status[task_idx] = this->write_sst_file(
+            db->GetName(), runs[run_pos], run_files[run_pos], tasks[task_idx].second);
+    });
+    run_segments.clear();
+    for (auto &file_s : file_status)
+    {
+        if (!file_s.ok())
+        {
+            spdlog::error("Unable to write SST files: {}", file_s.ToString());
+            return file_s;
+        }
+    }
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    spdlog::debug("Wrote {} SST files in {} ms", tasks.size(),
+        std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count());
+
+    // Ingestion decides the level of every run, hence it follows the plan one run at a time
+    rocksdb::IngestExternalFileOptions ingest_opt;
+    ingest_opt.move_files = true;
+    for (auto &run : runs)
+    {
+        std::vector<std::string> file_names;
+        std::copy_if(run.file_names.begin(), run.file_names.end(), std::back_inserter(file_names),
+            [](const std::string &file_name) {return !file_name.empty();});
+        if (file_names.empty()) { continue; }
+        status = db->IngestExternalFile(file_names, ingest_opt);
+        if (!status.ok())
+        {
+            spdlog::error("Unable to ingest SST files: {}", status.ToString());
+            return status;
+        }
+    }
+
+    rocksdb::ColumnFamilyMetaData cf_meta;
+    db->GetColumnFamilyMetaData(&cf_meta);
+    for (auto &run : runs)
+    {
+        if ((run.level_idx >= cf_meta.levels.size()) || cf_meta.levels[run.level_idx].files.empty())
+        {
+            spdlog::warn("Runs for level {} were ingested elsewhere, the DB needs exactly as many levels as the tree",
+                run.level_idx + 1);
+            break;
+        }
+    }
+
+    return status;
+}
+
+
+void FluidLSMBulkLoader::generate_sst_chunk(SstRun &run, size_t chunk_idx)
+{
+    size_t chunk_start = chunk_idx * SST_CHUNK_ENTRIES;
+    size_t chunk_entries = std::min<size_t>(SST_CHUNK_ENTRIES, run.num_entries - chunk_start);
+    std::unique_ptr<DataGenerator> gen = this->data_gen.fork(this->stream_seed(run, chunk_idx, false));
+
+    // SST files take keys in order, keys drawn twice collapse as they would in the memtable
+    std::vector<std::string> chunk;
+    chunk.reserve(chunk_entries);
+    for (size_t entry_num = 0; entry_num < chunk_entries; entry_num++)
+    {
+        chunk.push_back(gen->generate_key(""));
+    }
+    run.segment_paths[chunk_idx] = this->keys.write_segment(chunk);
+}
+
+
+void FluidLSMBulkLoader::split_sst_run(SstRun &run, const std::vector<const KeyFile *> &segments)
+{
+    uint64_t num_keys = 0;
+    for (auto segment : segments)
+    {
+        num_keys += segment->size();
+    }
+    double run_size = static_cast<double>(num_keys) * this->fluid_opt.entry_size;
+    size_t num_files = std::max<size_t>(1, std::ceil(run_size / run.file_size));
+    num_files = std::min<uint64_t>(num_files, std::max<uint64_t>(num_keys, 1));
+    spdlog::trace("Writing RUN {} at LEVEL {} : ~{} entries in {} files (run size ~ {:.3f} MB)",
+        run.run_idx, run.level_idx + 1, num_keys, num_files, run_size / (1 << 20));
+
+    run.file_names.assign(num_files, std::string());
+    run.splitters.clear();
+    if (num_files == 1) { return; }
+
+    std::vector<std::string> samples;
+    for (auto segment : segments)
+    {
+        uint64_t segment_samples = std::min<uint64_t>(
+            segment->size(), (SST_SPLIT_SAMPLES * num_files * segment->size()) / num_keys + 1);
+        for (uint64_t sample_idx = 0; sample_idx < segment_samples; sample_idx++)
+        {
+            samples.push_back(segment->key((sample_idx * segment->size()) / segment_samples).ToString());
+        }
+    }
+    std::sort(samples.begin(), samples.end());
+    for (size_t file_idx = 1; file_idx < num_files; file_idx++)
+    {
+        run.splitters.push_back(samples[(file_idx * samples.size()) / num_files]);
+    }
+}
+
+
+rocksdb::Status FluidLSMBulkLoader::write_sst_file(
+    const std::string &db_path,
+    SstRun &run,
+    const std::vector<const KeyFile *> &segments,
+    size_t file_idx)
+{
+    rocksdb::Slice lower, upper;
+    if (file_idx > 0) {lower = run.splitters[file_idx - 1];}
+    if (file_idx < run.splitters.size()) {upper = run.splitters[file_idx];}
+    KeyFileMerger merger(segments, (file_idx > 0) ? &lower : nullptr,
+        (file_idx < run.splitters.size()) ? &upper : nullptr);
+    if (!merger.valid())
+    {
+        // Splitters sampled twice leave a file without keys
+        return rocksdb::Status::OK();
+    }
+    std::unique_ptr<DataGenerator> gen = this->data_gen.fork(this->stream_seed(run, file_idx, true));
+
+    rocksdb::BlockBasedTableOptions table_options;
+    if (this->bits_per_level[run.level_idx] > 0)
+    {
+        table_options.filter_policy.reset(rocksdb::NewBloomFilterPolicy(this->bits_per_level[run.level_idx]));
+    }
+    table_options.no_block_cache = true;
+    rocksdb::Options sst_opt = this->rocksdb_opt;
+    sst_opt.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table_options));
+
+    // Each worker writes its own file, named by its place in the plan
+    std::string file_name = db_path + "/bulk_" + std::to_string(run.level_idx) + "_" + std::to_string(run.run_idx)
+        + "_" + std::to_string(file_idx) + ".sst";
+    rocksdb::SstFileWriter writer(rocksdb::EnvOptions(), sst_opt);
+    rocksdb::Status status = writer.Open(file_name);
+    for (; status.ok() && merger.valid(); merger.next())
+    {
+        rocksdb::Slice key = merger.key();
+        status = writer.Put(key, gen->generate_val(this->fluid_opt.entry_size - key.size(), ""));
+    }
+    if (status.ok())
+    {
+        status = writer.Finish();
+    }
+    if (status.ok())
+    {
+        run.file_names[file_idx] = file_name;
+    }
+
+    return status;
+}
+
+
+int FluidLSMBulkLoader::stream_seed(const SstRun &run, size_t part_idx, bool values) const
+{
+    std::seed_seq seq{
+        static_cast<uint32_t>(this->data_gen.seed),
+        static_cast<uint32_t>(run.level_idx),
+        static_cast<uint32_t>(run.run_idx),
+        static_cast<uint32_t>(part_idx),
+        static_cast<uint32_t>(values)};
+    uint32_t seed;
+    seq.generate(&seed, &seed + 1);
+
+    return static_cast<int>(seed);
+}
+
+
 void FluidLSMBulkLoader::CompactFiles(void *arg)
 {
     std::unique_ptr<tmpdb::CompactionTask> task(reinterpret_cast<tmpdb::CompactionTask *>(arg));
@@ -254,8 +561,7 @@ void FluidLSMBulkLoader::CompactFiles(void *arg)
 
         return;
     }
-    ((FluidLSMBulkLoader *) task->compactor)->compactions_left_count--;
-    ((FluidLSMBulkLoader *) task->compactor)->compactions_left_mutex.unlock();
+    ((FluidLSMBulkLoader *) task->compactor)->compaction_finished(task->origin_level_id);
 
     spdlog::trace("CompactFiles level {} -> {} finished with status : {}",
         task->origin_level_id + 1,
@@ -270,8 +576,9 @@ void FluidLSMBulkLoader::ScheduleCompaction(tmpdb::CompactionTask *task)
 {
     if (!task->is_a_retry)
     {
-        this->compactions_left_mutex.lock();
-        this->compactions_left_count++;
+        // Bulk loading compactions run one at a time, wait for the previous one before queueing the next
+        this->wait_for_compactions();
+        this->compaction_started(task->origin_level_id);
     }
     this->rocksdb_opt.env->Schedule(&FluidLSMBulkLoader::CompactFiles, task);
 
@@ -1,32 +1,72 @@
 #ifndef BULK_LOADER_H_ 
 #define BULK_LOADER_H_ 
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <thread>
 #include <vector>
 
 #include "spdlog/spdlog.h"
 #include "rocksdb/db.h"
+#include "rocksdb/filter_policy.h"
+#include "rocksdb/sst_file_writer.h"
+#include "rocksdb/table.h"
 
 #include "tmpdb/fluid_lsm_compactor.hpp"
+#include "tmpdb/lsm_cost_model.hpp"
 
 #include "data_generator.hpp"
+#include "key_file.hpp"
+#include "key_spiller.hpp"
 
 #define BATCH_SIZE 100
+#define SST_CHUNK_ENTRIES 1000000 //> keys drawn by one task of the SST loader, fixed so the data never depends on threads
+#define SST_SPLIT_SAMPLES 64 //> keys sampled per file of a run to pick the splitters between its files
+
+/**
+ * @brief A run written by the SST loader. Its keys are drawn in chunks of SST_CHUNK_ENTRIES, each from a stream seeded
+ * by (seed, level, run, chunk) and spilled as a sorted segment of the key spiller. Files are merged from the segments
+ * between splitter keys, so a run never has to fit in memory.
+ */
+typedef struct SstRun
+{
+size_t level_idx;
+size_t run_idx;
+size_t num_entries;                     //> keys drawn, before duplicates collapse
+uint64_t file_size;                     //> UINT64_MAX writes the run as a single file
+std::vector<std::string> segment_paths; //> one per chunk
+std::vector<std::string> splitters;     //> smallest key of every file but the first
+std::vector<std::string> file_names;    //> empty for a file no key falls into
+} SstRun;
+
 
 class FluidLSMBulkLoader : public tmpdb::FluidLSMCompactor
 {
 public:
     bool stop_after_level_filled;
-    std::vector<std::string> keys;
+    bool sst_loader; //> write every run once as SST files ingested into its level, instead of flushing and compacting
+    size_t num_threads; //> workers generating and writing runs of the SST loader
+    KeySpiller keys; //> every key loaded, merged into the existing keys file once loading is done
 
     FluidLSMBulkLoader(
         DataGenerator &data_gen,
         const tmpdb::FluidOptions fluid_opt,
         const rocksdb::Options rocksdb_opt,
-        bool stop_after_level_filled=false)
+        const std::string key_spill_dir,
+        bool stop_after_level_filled=false,
+        bool sst_loader=false,
+        size_t num_threads=1)
             : FluidLSMCompactor(fluid_opt, rocksdb_opt),
             stop_after_level_filled(stop_after_level_filled),
+            sst_loader(sst_loader),
+            num_threads(std::max<size_t>(num_threads, 1)),
+            keys(key_spill_dir),
             data_gen(data_gen) {};
 
     rocksdb::Status bulk_load_entries(rocksdb::DB *db, size_t num_entries);
@@ -36,6 +76,8 @@ public:
     // Override both compaction events to prevent any compactions during bulk loading
     void OnFlushCompleted(rocksdb::DB */* db */, const ROCKSDB_NAMESPACE::FlushJobInfo &/* info */) override {};
 
+    void OnCompactionCompleted(rocksdb::DB */* db */, const ROCKSDB_NAMESPACE::CompactionJobInfo &/* info */) override {};
+
     tmpdb::CompactionTask * PickCompaction(rocksdb::DB */* db */,
                                            const std::string &/* cf_name */,
                                            const size_t /* level */) override {return nullptr;};
@@ -45,12 +87,44 @@ public:
     void ScheduleCompaction(tmpdb::CompactionTask *task) override;
 private:
     DataGenerator &data_gen;
+    std::vector<double> bits_per_level; //> Monkey allocation over the levels being loaded, SST loader only
 
     rocksdb::Status bulk_load(rocksdb::DB *db, std::vector<size_t> entries_per_level, size_t num_levels, size_t max_entries);
 
     rocksdb::Status bulk_load_single_level(rocksdb::DB *db, size_t level_idx, size_t num_entries, size_t num_runs);
 
     rocksdb::Status bulk_load_single_run(rocksdb::DB *db, size_t num_entries);
+
+    /**
+     * @brief Appends the runs of a level to the SST loader plan. Runs of the first level stay apart the way flushes
+     * leave them, every other level holds the single run bulk_load_single_level merges its runs into, split into files
+     * by the file size policy.
+     */
+    void plan_sst_level(size_t level_idx, size_t num_entries, size_t num_runs, std::vector<SstRun> &runs);
+
+    /**
+     * @brief Generates, sorts and writes every planned run on num_threads workers, then ingests the runs one by one in
+     * plan order. Ingestion places a file at the deepest level above the first one it overlaps, so with levels planned
+     * bottom up every run lands on top of the level below, and the last level at the bottom of a DB opened with as
+     * many levels as the tree.
+     */
+    rocksdb::Status sst_load(rocksdb::DB *db, std::vector<SstRun> &runs);
+
+    void generate_sst_chunk(SstRun &run, size_t chunk_idx);
+
+    /**
+     * @brief Splits a run into files by the file size policy, picking splitters from keys sampled evenly across its
+     * segments so that files hold about the same number of keys
+     */
+    void split_sst_run(SstRun &run, const std::vector<const KeyFile *> &segments);
+
+    rocksdb::Status write_sst_file(
+        const std::string &db_path, SstRun &run, const std::vector<const KeyFile *> &segments, size_t file_idx);
+
+    /**
+     * @brief Seed of the stream generating one part of a run, the keys of a chunk or the values of a file
+     */
+    int stream_seed(const SstRun &run, size_t part_idx, bool values) const;
 };
 
 #endif /*  BULK_LOADER_H_ */
@@ -4,21 +4,17 @@ RandomGenerator::RandomGenerator(int seed)
 {
     this->seed = seed;
     this->engine.seed(this->seed);
-    srand(this->seed);
     this->dist_left = std::uniform_int_distribution<int>(KEY_BOTTOM, KEY_MIDDLE_LEFT);
     this->dist_right = std::uniform_int_distribution<int>(KEY_MIDDLE_RIGHT, KEY_DOMAIN);
 }
 
 
-RandomGenerator::RandomGenerator()
-{
-    RandomGenerator(0);
-}
+RandomGenerator::RandomGenerator() : RandomGenerator(0) {}
 
 
 std::string RandomGenerator::generate_rnd()
 {
-    if (std::rand() % 2)
+    if (this->dist_side(this->engine))
     {
         return std::to_string(this->dist_left(this->engine));
     }
@@ -29,6 +25,12 @@ std::string RandomGenerator::generate_rnd()
 }
 
 
+std::unique_ptr<DataGenerator> RandomGenerator::fork(int seed)
+{
+    return std::unique_ptr<DataGenerator>(new RandomGenerator(seed));
+}
+
+
 std::pair<std::string, std::string> DataGenerator::generate_kv_pair(size_t kv_size)
 {
     return this->generate_kv_pair(kv_size, "", "");
@@ -3,6 +3,7 @@
 
 #include <ctime>
 #include <cassert>
+#include <memory>
 #include <string>
 #include <ctime>
 #include <random>
@@ -20,6 +21,8 @@ class DataGenerator
 public:
     int seed;
 
+    virtual ~DataGenerator() {}
+
     virtual std::string generate_key(const std::string key_prefix) = 0;
 
     virtual std::string generate_val(size_t value_size, const std::string value_prefix) = 0;
@@ -30,6 +33,12 @@ public:
         size_t kv_size,
         const std::string key_prefix,
         const std::string value_prefix);
+
+    /**
+     * @brief A new generator of the same kind with its own stream, for workers generating data concurrently. The
+     * data only depends on the seed, never on the state of this generator.
+     */
+    virtual std::unique_ptr<DataGenerator> fork(int seed) = 0;
 };
 
 
@@ -45,11 +54,14 @@ public:
 
     std::string generate_rnd();
 
+    std::unique_ptr<DataGenerator> fork(int seed);
+
 private:
     // We generate a distribution with a large gap in the middle in order fo the test suite to have the functionality of
     // giving keys that are still in the domain but gurantee an empty read
     std::uniform_int_distribution<int> dist_left;
     std::uniform_int_distribution<int> dist_right;
+    std::bernoulli_distribution dist_side; //> left or right of the gap, drawn from the engine to keep streams apart
     std::mt19937 engine;
 };
 
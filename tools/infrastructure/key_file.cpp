@@ -0,0 +1,260 @@
+#include "key_file.hpp"
+
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static uint32_t max_key_width(const std::vector<std::string> &keys)
+{
+    size_t key_width = 1;
+    for (auto &key : keys)
+    {
+        key_width = std::max(key_width, key.size());
+    }
+
+    return key_width;
+}
+
+
+bool KeyFileWriter::open(const std::string &path, uint32_t key_width)
+{
+    this->header = KeyFileHeader();
+    std::strncpy(this->header.magic, KEY_FILE_MAGIC, sizeof(this->header.magic));
+    this->header.version = KEY_FILE_VERSION;
+    this->header.key_width = key_width;
+    this->header.num_keys = 0;
+    this->last_key.clear();
+    this->record.assign(key_width, '\0');
+
+    this->file.open(path, std::ios::binary | std::ios::trunc);
+    if (!this->file.is_open())
+    {
+        spdlog::error("Unable to write key file: {}", path);
+        return false;
+    }
+    this->file.write(reinterpret_cast<const char *>(&this->header), sizeof(this->header));
+
+    return this->file.good();
+}
+
+
+bool KeyFileWriter::add(const rocksdb::Slice &key)
+{
+    if (key.size() > this->header.key_width)
+    {
+        spdlog::error("Key of {} bytes does not fit records of {} bytes", key.size(), this->header.key_width);
+        return false;
+    }
+    if ((this->header.num_keys > 0) && (key.compare(rocksdb::Slice(this->last_key)) <= 0))
+    {
+        return key == rocksdb::Slice(this->last_key);
+    }
+
+    std::memcpy(&this->record[0], key.data(), key.size());
+    std::memset(&this->record[key.size()], '\0', this->header.key_width - key.size());
+    this->file.write(this->record.data(), this->header.key_width);
+    this->last_key.assign(key.data(), key.size());
+    this->header.num_keys++;
+
+    return this->file.good();
+}
+
+
+bool KeyFileWriter::finish()
+{
+    if (!this->file.is_open()) {return true;}
+
+    this->file.seekp(0);
+    this->file.write(reinterpret_cast<const char *>(&this->header), sizeof(this->header));
+    bool ok = this->file.good();
+    this->file.close();
+
+    return ok;
+}
+
+
+bool KeyFile::open(const std::string &path, bool random_access)
+{
+    this->close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        spdlog::error("Unable to read key file: {}", path);
+        return false;
+    }
+
+    struct stat file_stat;
+    bool ok = (fstat(fd, &file_stat) == 0) && (static_cast<size_t>(file_stat.st_size) >= sizeof(KeyFileHeader));
+    if (ok)
+    {
+        this->mapping_size = file_stat.st_size;
+        this->mapping = mmap(nullptr, this->mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+        ok = (this->mapping != MAP_FAILED);
+        if (!ok) {this->mapping = nullptr;}
+    }
+    ::close(fd);
+
+    if (ok)
+    {
+        std::memcpy(&this->header, this->mapping, sizeof(KeyFileHeader));
+        ok = (std::strncmp(this->header.magic, KEY_FILE_MAGIC, sizeof(this->header.magic)) == 0)
+            && (this->header.version == KEY_FILE_VERSION)
+            && (this->header.key_width > 0)
+            && (this->mapping_size >= sizeof(KeyFileHeader) + this->header.num_keys * this->header.key_width);
+    }
+    if (!ok)
+    {
+        spdlog::error("Not a key file: {}", path);
+        this->close();
+        return false;
+    }
+
+    // Sampling keys touches pages at random, read ahead would only pull in records nobody asked for
+    madvise(this->mapping, this->mapping_size, random_access ? MADV_RANDOM : MADV_SEQUENTIAL);
+    this->records = static_cast<const char *>(this->mapping) + sizeof(KeyFileHeader);
+
+    return true;
+}
+
+
+void KeyFile::close()
+{
+    if (this->mapping)
+    {
+        munmap(this->mapping, this->mapping_size);
+    }
+    this->mapping = nullptr;
+    this->mapping_size = 0;
+    this->records = nullptr;
+    this->header = KeyFileHeader();
+}
+
+
+uint64_t KeyFile::lower_bound(const rocksdb::Slice &target) const
+{
+    uint64_t first = 0, last = this->size();
+    while (first < last)
+    {
+        uint64_t middle = first + (last - first) / 2;
+        if (this->key(middle).compare(target) < 0)
+        {
+            first = middle + 1;
+        }
+        else
+        {
+            last = middle;
+        }
+    }
+
+    return first;
+}
+
+
+bool KeyFile::write(const std::string &path, std::vector<std::string> &keys)
+{
+    std::sort(keys.begin(), keys.end());
+
+    KeyFileWriter writer;
+    bool ok = writer.open(path, max_key_width(keys));
+    for (size_t idx = 0; ok && (idx < keys.size()); idx++)
+    {
+        ok = writer.add(keys[idx]);
+    }
+
+    return writer.finish() && ok;
+}
+
+
+bool KeyFile::append(const std::string &path, std::vector<std::string> &keys)
+{
+    KeyFile existing;
+    if (access(path.c_str(), F_OK) != 0)
+    {
+        return KeyFile::write(path, keys);
+    }
+    if (!existing.open(path, false))
+    {
+        return false;
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::string merge_path = path + ".tmp";
+    KeyFileWriter writer;
+    bool ok = writer.open(merge_path, std::max(existing.key_width(), max_key_width(keys)));
+    uint64_t existing_idx = 0;
+    size_t key_idx = 0;
+    while (ok && ((existing_idx < existing.size()) || (key_idx < keys.size())))
+    {
+        if ((key_idx == keys.size())
+            || ((existing_idx < existing.size()) && (existing.key(existing_idx).compare(keys[key_idx]) <= 0)))
+        {
+            ok = writer.add(existing.key(existing_idx++));
+        }
+        else
+        {
+            ok = writer.add(keys[key_idx++]);
+        }
+    }
+    ok = writer.finish() && ok;
+    existing.close();
+
+    if (!ok || (std::rename(merge_path.c_str(), path.c_str()) != 0))
+    {
+        spdlog::error("Unable to merge keys into {}", path);
+        std::remove(merge_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+KeyFileMerger::KeyFileMerger(
+    const std::vector<const KeyFile *> &files,
+    const rocksdb::Slice *lower,
+    const rocksdb::Slice *upper)
+{
+    for (auto file : files)
+    {
+        Cursor cursor;
+        cursor.file = file;
+        cursor.idx = lower ? file->lower_bound(*lower) : 0;
+        cursor.end = upper ? file->lower_bound(*upper) : file->size();
+        if (cursor.idx < cursor.end)
+        {
+            this->heap.push_back(cursor);
+        }
+    }
+    std::make_heap(this->heap.begin(), this->heap.end(), KeyFileMerger::greater);
+    if (this->valid())
+    {
+        this->current = this->heap.front().file->key(this->heap.front().idx);
+    }
+}
+
+
+void KeyFileMerger::next()
+{
+    // Every file holds a key once, so the current key is left behind once no cursor points at it anymore
+    rocksdb::Slice last = this->current;
+    while (this->valid() && (this->heap.front().file->key(this->heap.front().idx) == last))
+    {
+        std::pop_heap(this->heap.begin(), this->heap.end(), KeyFileMerger::greater);
+        Cursor &cursor = this->heap.back();
+        if (++cursor.idx < cursor.end)
+        {
+            std::push_heap(this->heap.begin(), this->heap.end(), KeyFileMerger::greater);
+        }
+        else
+        {
+            this->heap.pop_back();
+        }
+    }
+    if (this->valid())
+    {
+        this->current = this->heap.front().file->key(this->heap.front().idx);
+    }
+}
@@ -0,0 +1,169 @@
+#ifndef KEY_FILE_H_
+#define KEY_FILE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+#include "rocksdb/slice.h"
+
+#define KEY_FILE_NAME "existing_keys.bin"
+#define KEY_FILE_MAGIC "TMPKEYS"
+#define KEY_FILE_VERSION 1
+
+/**
+ * @brief Header of a key file, followed by num_keys records of key_width bytes in ascending key order. Keys shorter
+ * than key_width are padded with '\0', which keeps records in the order of their keys.
+ */
+typedef struct KeyFileHeader
+{
+char magic[8];      //> KEY_FILE_MAGIC, null terminated
+uint32_t version;
+uint32_t key_width; //> bytes per record
+uint64_t num_keys;
+} KeyFileHeader;
+
+
+/**
+ * @brief Writes a key file record by record, keys have to be added in ascending order
+ */
+class KeyFileWriter
+{
+public:
+    KeyFileWriter() {}
+
+    ~KeyFileWriter() {this->finish();}
+
+    bool open(const std::string &path, uint32_t key_width);
+
+    /**
+     * @brief Adds a key, a repeat of the last key added is skipped
+     */
+    bool add(const rocksdb::Slice &key);
+
+    /**
+     * @brief Writes the final key count into the header and closes the file
+     */
+    bool finish();
+
+    uint64_t num_keys() const {return this->header.num_keys;}
+
+private:
+    std::ofstream file;
+    KeyFileHeader header;
+    std::string last_key;
+    std::string record;
+};
+
+
+/**
+ * @brief Read only view of a key file mapped into memory, so keys are sampled straight from the page cache without
+ * loading or sorting anything up front
+ */
+class KeyFile
+{
+public:
+    KeyFile() {}
+
+    ~KeyFile() {this->close();}
+
+    KeyFile(const KeyFile &) = delete;
+
+    KeyFile &operator=(const KeyFile &) = delete;
+
+    /**
+     * @brief Maps a key file
+     *
+     * @param path
+     * @param random_access Keys are sampled at random rather than walked in order, which turns off read ahead
+     */
+    bool open(const std::string &path, bool random_access = true);
+
+    void close();
+
+    bool is_open() const {return this->mapping != nullptr;}
+
+    uint64_t size() const {return this->header.num_keys;}
+
+    uint32_t key_width() const {return this->header.key_width;}
+
+    /**
+     * @brief Key at a position, pointing into the mapping
+     */
+    rocksdb::Slice key(uint64_t idx) const
+    {
+        const char *record = this->records + idx * this->header.key_width;
+        return rocksdb::Slice(record, strnlen(record, this->header.key_width));
+    }
+
+    /**
+     * @brief Position of the first key not less than target, size() if every key is less
+     */
+    uint64_t lower_bound(const rocksdb::Slice &target) const;
+
+    /**
+     * @brief Sorts and deduplicates keys in place, then writes them as a new key file
+     */
+    static bool write(const std::string &path, std::vector<std::string> &keys);
+
+    /**
+     * @brief Merges keys into the key file at path, creating it if missing. The merge is written beside the file and
+     * renamed over it, views already mapping the old file keep reading the old keys.
+     */
+    static bool append(const std::string &path, std::vector<std::string> &keys);
+
+private:
+    KeyFileHeader header = KeyFileHeader();
+    void *mapping = nullptr;
+    size_t mapping_size = 0;
+    const char *records = nullptr;
+};
+
+
+/**
+ * @brief Walks the union of several key files in ascending order, each key once
+ */
+class KeyFileMerger
+{
+public:
+    /**
+     * @brief Construct a new KeyFileMerger object
+     *
+     * @param files Key files to merge, they have to stay open while merging
+     * @param lower Smallest key to visit, nullptr starts from the first key
+     * @param upper Keys from upper on are skipped, nullptr visits up to the last key
+     */
+    KeyFileMerger(const std::vector<const KeyFile *> &files, const rocksdb::Slice *lower = nullptr,
+        const rocksdb::Slice *upper = nullptr);
+
+    bool valid() const {return !this->heap.empty();}
+
+    /**
+     * @brief Current key, pointing into the mapping of its file
+     */
+    rocksdb::Slice key() const {return this->current;}
+
+    void next();
+
+private:
+    typedef struct Cursor
+    {
+    const KeyFile *file;
+    uint64_t idx;
+    uint64_t end;
+    } Cursor;
+
+    std::vector<Cursor> heap; //> cursors with keys left, the smallest key on top
+    rocksdb::Slice current;
+
+    static bool greater(const Cursor &left, const Cursor &right)
+    {
+        return left.file->key(left.idx).compare(right.file->key(right.idx)) > 0;
+    }
+};
+
+#endif /* KEY_FILE_H_ */
@@ -0,0 +1,95 @@
+#include "key_spiller.hpp"
+
+#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+bool KeySpiller::add(const std::string &key)
+{
+    this->buffer.push_back(key);
+    if (this->buffer.size() < this->buffer_keys)
+    {
+        return true;
+    }
+
+    bool ok = !this->write_segment(this->buffer).empty();
+    std::vector<std::string>().swap(this->buffer);
+
+    return ok;
+}
+
+
+std::string KeySpiller::write_segment(std::vector<std::string> &keys)
+{
+    std::string segment_path;
+    {
+        std::lock_guard<std::mutex> lock(this->segments_mutex);
+        if (this->segment_paths.empty())
+        {
+            mkdir(this->spill_dir.c_str(), 0755);
+        }
+        segment_path = this->spill_dir + "/segment_" + std::to_string(this->segment_paths.size()) + ".keys";
+        this->segment_paths.push_back(segment_path);
+        this->num_keys += keys.size();
+    }
+
+    if (!KeyFile::write(segment_path, keys))
+    {
+        return std::string();
+    }
+
+    return segment_path;
+}
+
+
+bool KeySpiller::merge_into(const std::string &path)
+{
+    if (!this->buffer.empty() && this->write_segment(this->buffer).empty())
+    {
+        return false;
+    }
+    std::vector<std::string>().swap(this->buffer);
+
+    std::lock_guard<std::mutex> lock(this->segments_mutex);
+    std::vector<std::unique_ptr<KeyFile>> segments;
+    std::vector<const KeyFile *> files;
+    uint32_t key_width = 1;
+    for (auto &segment_path : this->segment_paths)
+    {
+        segments.emplace_back(new KeyFile());
+        if (!segments.back()->open(segment_path, false))
+        {
+            return false;
+        }
+        files.push_back(segments.back().get());
+        key_width = std::max(key_width, segments.back()->key_width());
+    }
+    spdlog::debug("Merging {} key segments", files.size());
+
+    KeyFileWriter writer;
+    bool ok = writer.open(path, key_width);
+    for (KeyFileMerger merger(files); ok && merger.valid(); merger.next())
+    {
+        ok = writer.add(merger.key());
+    }
+    ok = writer.finish() && ok;
+    segments.clear();
+    this->remove_segments();
+
+    return ok;
+}
+
+
+void KeySpiller::remove_segments()
+{
+    for (auto &segment_path : this->segment_paths)
+    {
+        std::remove(segment_path.c_str());
+    }
+    if (!this->segment_paths.empty())
+    {
+        rmdir(this->spill_dir.c_str());
+    }
+    this->segment_paths.clear();
+}
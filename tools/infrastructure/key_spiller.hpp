@@ -0,0 +1,67 @@
+#ifndef KEY_SPILLER_H_
+#define KEY_SPILLER_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+
+#include "key_file.hpp"
+
+#define SPILL_BUFFER_KEYS 1000000 //> keys buffered before they are sorted and spilled as a segment
+
+/**
+ * @brief Collects the keys of a bulk load on disk with bounded memory. Keys are buffered and spilled as sorted
+ * segments, themselves key files, which are merged into a single key file once loading is done.
+ */
+class KeySpiller
+{
+public:
+    /**
+     * @brief Construct a new KeySpiller object
+     *
+     * @param spill_dir Directory holding the segments, created with the first one and removed by merge_into
+     * @param buffer_keys Keys added one by one that are held in memory at most
+     */
+    KeySpiller(const std::string &spill_dir, size_t buffer_keys = SPILL_BUFFER_KEYS)
+        : spill_dir(spill_dir), buffer_keys(std::max<size_t>(buffer_keys, 1)) {}
+
+    ~KeySpiller() {this->remove_segments();}
+
+    /**
+     * @brief Buffers a key, spilling the buffer once full. Not thread safe, unlike write_segment.
+     */
+    bool add(const std::string &key);
+
+    /**
+     * @brief Sorts keys in place and writes them as a new segment
+     *
+     * @return std::string Path of the segment, empty on failure
+     */
+    std::string write_segment(std::vector<std::string> &keys);
+
+    /**
+     * @brief Spills the buffer and merges every segment into a single key file at path, removing the segments
+     */
+    bool merge_into(const std::string &path);
+
+    /**
+     * @brief Keys added or written, counting duplicates
+     */
+    uint64_t size() const {return this->num_keys;}
+
+private:
+    std::string spill_dir;
+    size_t buffer_keys;
+    std::vector<std::string> buffer;
+    uint64_t num_keys = 0;
+
+    std::mutex segments_mutex;
+    std::vector<std::string> segment_paths;
+
+    void remove_segments();
+};
+
+#endif /* KEY_SPILLER_H_ */
@@ -0,0 +1,133 @@
+#include "template_store.hpp"
+
+#include <unistd.h>
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+
+std::string TemplateStore::template_key(
+    const tmpdb::FluidOptions &fluid_opt,
+    int seed,
+    const std::string &loader_opt)
+{
+    std::string content = fluid_opt.config_string() + "\nseed=" + std::to_string(seed) + "\n" + loader_opt;
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (auto c : content)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= FNV_PRIME;
+    }
+
+    return fmt::format("{:016x}", hash);
+}
+
+
+bool TemplateStore::contains(const std::string &key) const
+{
+    return this->env->FileExists(this->template_path(key) + "/CURRENT").ok();
+}
+
+
+bool TemplateStore::save(const std::string &db_path, const std::string &key)
+{
+    this->env->CreateDirIfMissing(this->store_path);
+    std::string staging_path = this->template_path(key) + ".tmp" + std::to_string(getpid());
+    if (!TemplateStore::clone(this->env, db_path, staging_path))
+    {
+        TemplateStore::remove_dir(this->env, staging_path);
+        return false;
+    }
+
+    rocksdb::Status status = this->env->RenameFile(staging_path, this->template_path(key));
+    if (!status.ok())
+    {
+        TemplateStore::remove_dir(this->env, staging_path);
+        if (this->contains(key))
+        {
+            spdlog::info("Template {} was saved by another build", key);
+            return true;
+        }
+        spdlog::error("Unable to save template {}: {}", key, status.ToString());
+        return false;
+    }
+    spdlog::info("Saved template {}", key);
+
+    return true;
+}
+
+
+bool TemplateStore::clone(rocksdb::Env *env, const std::string &src_path, const std::string &dst_path)
+{
+    std::vector<std::string> children;
+    rocksdb::Status status = env->GetChildren(src_path, &children);
+    if (status.ok())
+    {
+        status = env->CreateDirIfMissing(dst_path);
+    }
+    if (!status.ok())
+    {
+        spdlog::error("Unable to clone {} into {}: {}", src_path, dst_path, status.ToString());
+        return false;
+    }
+
+    size_t linked = 0, copied = 0;
+    for (auto &name : children)
+    {
+        // The lock and info logs belong to whoever has the DB open
+        if ((name == ".") || (name == "..") || (name == "LOCK") || (name.compare(0, 3, "LOG") == 0)) { continue; }
+
+        std::string src_file = src_path + "/" + name;
+        std::string dst_file = dst_path + "/" + name;
+        bool is_dir = false;
+        if (env->IsDirectory(src_file, &is_dir).ok() && is_dir) { continue; }
+
+        bool is_sst = (name.size() > 4) && (name.compare(name.size() - 4, 4, ".sst") == 0);
+        if (is_sst && env->LinkFile(src_file, dst_file).ok())
+        {
+            linked++;
+        }
+        else if (TemplateStore::copy_file(src_file, dst_file))
+        {
+            copied++;
+        }
+        else
+        {
+            spdlog::error("Unable to clone {} into {}", src_file, dst_path);
+            return false;
+        }
+    }
+    spdlog::debug("Cloned {} into {} : {} files linked, {} copied", src_path, dst_path, linked, copied);
+
+    return true;
+}
+
+
+bool TemplateStore::copy_file(const std::string &src_path, const std::string &dst_path)
+{
+    std::ifstream src(src_path, std::ios::binary);
+    std::ofstream dst(dst_path, std::ios::binary | std::ios::trunc);
+    if (!src.is_open() || !dst.is_open()) {return false;}
+
+    // Streaming an empty buffer sets the fail bit, empty files only need to be created
+    if (src.peek() != std::ifstream::traits_type::eof())
+    {
+        dst << src.rdbuf();
+    }
+
+    return dst.good();
+}
+
+
+void TemplateStore::remove_dir(rocksdb::Env *env, const std::string &path)
+{
+    std::vector<std::string> children;
+    if (!env->GetChildren(path, &children).ok()) {return;}
+
+    for (auto &name : children)
+    {
+        if ((name == ".") || (name == "..")) { continue; }
+        env->DeleteFile(path + "/" + name);
+    }
+    env->DeleteDir(path);
+}
@@ -0,0 +1,65 @@
+#ifndef TEMPLATE_STORE_H_
+#define TEMPLATE_STORE_H_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+#include "rocksdb/env.h"
+
+#include "tmpdb/fluid_options.hpp"
+
+/**
+ * @brief Directory of built trees, one closed DB per template, so experiments repeating a configuration clone the tree
+ * instead of bulk loading it again. Templates are content addressed by the options and seed of the build.
+ */
+class TemplateStore
+{
+public:
+    TemplateStore(const std::string &store_path, rocksdb::Env *env = rocksdb::Env::Default())
+        : store_path(store_path), env(env) {}
+
+    /**
+     * @brief Key of the tree a build produces, FNV-1a of the canonical fluid config, the data seed and any loader
+     * option changing the tree
+     *
+     * @param fluid_opt Options of the build
+     * @param seed Seed of the data generator
+     * @param loader_opt Loader options, e.g. the loading mode
+     * @return std::string 16 hex digits
+     */
+    static std::string template_key(const tmpdb::FluidOptions &fluid_opt, int seed, const std::string &loader_opt);
+
+    std::string template_path(const std::string &key) const {return this->store_path + "/" + key;}
+
+    bool contains(const std::string &key) const;
+
+    /**
+     * @brief Saves a closed DB as the template of key. The clone is staged beside the template and renamed into place,
+     * so a template is either complete or missing, and a build racing another for the same key keeps the first one.
+     */
+    bool save(const std::string &db_path, const std::string &key);
+
+    /**
+     * @brief Clones a closed DB into dst_path. RocksDB never modifies an SST file once written, hence SST files are
+     * hardlinked and shared with the source, while every other file is copied. Files are copied when linking fails,
+     * e.g. across file systems.
+     */
+    static bool clone(rocksdb::Env *env, const std::string &src_path, const std::string &dst_path);
+
+    /**
+     * @brief Removes every file of a directory, then the directory itself. Subdirectories are left alone, in which
+     * case the directory stays as well.
+     */
+    static void remove_dir(rocksdb::Env *env, const std::string &path);
+
+private:
+    std::string store_path;
+    rocksdb::Env *env;
+
+    static bool copy_file(const std::string &src_path, const std::string &dst_path);
+};
+
+#endif /* TEMPLATE_STORE_H_ */